@@ -14,9 +14,12 @@ namespace Mylib
 
 // ---------------------------------------------------
 
-template <size_t buffer_size = 1024>
+// Tpool can be Memory::ConcurrentPoolCore when coroutines
+// are created and destroyed by multiple threads.
+
+template <size_t buffer_size = 1024, typename Tpool = Memory::PoolCore>
 struct Coroutine {
-	inline static Memory::PoolCore pool = Memory::PoolCore(buffer_size, 16, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	inline static Tpool pool = Tpool(buffer_size, 16, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
 
 	struct promise_type {
 		// If the coroutine is not waiting for a timer event, this is nullptr.
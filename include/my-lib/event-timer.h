@@ -25,7 +25,7 @@ namespace Event
 
 // ---------------------------------------------------
 
-template <typename Coroutine, typename Tget_current_time>
+template <typename Coroutine, typename Tget_current_time, std::size_t callback_size = default_callback_size>
 class Timer
 {
 public:
@@ -43,18 +43,14 @@ public:
 		bool re_schedule;
 	};
 
-	struct Descriptor__ {
-		Event *ptr = nullptr;
-	};
-
-	struct Descriptor {
-		std::shared_ptr<Descriptor__> shared_ptr;
+private:
+	struct EventFull;
+	using DescriptorPool = SlotPool<EventFull*>;
 
-		bool is_valid () const noexcept
-		{
-			return (this->shared_ptr && this->shared_ptr->ptr != nullptr);
-		}
-	};
+public:
+	// Handle to a slot table owned by the timer (8 bytes, trivially copyable).
+	// Valid (timer.is_valid) until the event is triggered or unscheduled.
+	using Descriptor = typename DescriptorPool::Handle;
 
 	struct CoroutineAwaiter {
 		Timer& timer;
@@ -112,11 +108,11 @@ public:
 	friend struct CoroutineAwaiter;
 
 private:
-	using TimerCallback = Callback<Event>;
+	using TimerCallback = InlineFunction<void (Event&), callback_size>;
 
 	struct EventCallback {
 		Descriptor descriptor;
-		Memory::unique_ptr<TimerCallback> callback;
+		TimerCallback callback;
 	};
 
 	struct EventCoroutine {
@@ -148,17 +144,20 @@ private:
 	Tget_current_time get_current_time_;
 	Memory::Manager& memory_manager;
 	std::vector<Internal> events; // we let the vector use its standard allocators
+	DescriptorPool descriptors;
 
 public:
 	Timer (Tget_current_time get_current_time__)
 		: get_current_time_(get_current_time__),
-		  memory_manager(Memory::default_manager)
+		  memory_manager(Memory::default_manager),
+		  descriptors(memory_manager)
 	{
 	}
 
 	Timer (Tget_current_time get_current_time__, Memory::Manager& memory_manager_)
 		: get_current_time_(get_current_time__),
-		  memory_manager(memory_manager_)
+		  memory_manager(memory_manager_),
+		  descriptors(memory_manager)
 	{
 	}
 
@@ -200,12 +199,11 @@ public:
 				
 				if (std::holds_alternative<EventCallback>(event->var_callback)) {
 					EventCallback& callback = std::get<EventCallback>(event->var_callback);
-					auto& c = *(callback.callback);
 
 					if constexpr (debug()) std::cout << "\tcallback time=" << event->time << std::endl;
 
 					if (event->enabled)
-						c(*event);
+						callback.callback(*event);
 				}
 				else if (std::holds_alternative<EventCoroutine>(event->var_callback)) {
 					EventCoroutine& event_coro = std::get<EventCoroutine>(event->var_callback);
@@ -237,35 +235,44 @@ public:
 	Descriptor schedule_event (const Ttime& time, const Tcallback& callback)
 		//requires std::is_rvalue_reference<decltype(callback)>::value
 	{
-		using TallocatorDescriptor = Memory::AllocatorSTL<Descriptor__>;
-		TallocatorDescriptor descriptor_allocator(this->memory_manager);
-
-		auto unique_ptr = Memory::make_unique<Tcallback>(this->memory_manager, callback);
+		TimerCallback timer_callback(this->memory_manager, callback);
 
 		EventFull *event = this->memory_manager.template allocate_construct_type<EventFull>();
 		event->time = time;
 
-		std::shared_ptr<Descriptor__> shared_ptr_ = std::allocate_shared<Descriptor__>(descriptor_allocator, Descriptor__ {
-			.ptr = event
-		});
+		try {
+			const Descriptor descriptor = this->descriptors.create(event);
 
-		event->var_callback = EventCallback {
-			.descriptor = Descriptor { .shared_ptr = shared_ptr_ },
-			.callback = std::move(unique_ptr),
-		},
-		event->enabled = true;
+			event->var_callback = EventCallback {
+				.descriptor = descriptor,
+				.callback = std::move(timer_callback),
+			},
+			event->enabled = true;
 
-		this->push(event);
-		
-		return Descriptor { .shared_ptr = std::move(shared_ptr_) };
+			this->push(event);
+
+			return descriptor;
+		}
+		catch (...) {
+			this->destroy_event(event);
+			throw;
+		}
+	}
+
+	inline bool is_valid (const Descriptor& descriptor) const noexcept
+	{
+		return this->descriptors.is_valid(descriptor);
 	}
 
 	inline void unschedule_event (Descriptor& descriptor)
 	{
-		EventFull *event = static_cast<EventFull*>(descriptor.shared_ptr->ptr);
-		event->enabled = false; // better than rebuild the heap
-		descriptor.shared_ptr->ptr = nullptr;
-		descriptor.shared_ptr.reset();
+		EventFull **event = this->descriptors.get(descriptor);
+
+		mylib_assert_msg(event != nullptr, "unscheduling an invalid timer event descriptor")
+
+		(*event)->enabled = false; // better than rebuild the heap
+		this->descriptors.destroy(descriptor);
+		descriptor = Descriptor();
 	}
 
 	inline void force_resume_coroutine (Coroutine coro)
@@ -324,7 +331,10 @@ private:
 	{
 		if (std::holds_alternative<EventCallback>(event->var_callback)) {
 			EventCallback& callback = std::get<EventCallback>(event->var_callback);
-			callback.descriptor.shared_ptr->ptr = nullptr;
+
+			// already destroyed if the event was unscheduled
+			if (this->descriptors.is_valid(callback.descriptor))
+				this->descriptors.destroy(callback.descriptor);
 		}
 		this->memory_manager.template destruct_deallocate_type<EventFull>(event);
 	}
@@ -6,13 +6,21 @@
 #include <functional>
 #include <type_traits>
 #include <memory>
+#include <vector>
+#include <limits>
+#include <span>
+#include <iterator>
+#include <tuple>
 
 #include <cstdint>
+#include <cstddef>
 
 #include <my-lib/macros.h>
 #include <my-lib/std.h>
 #include <my-lib/memory.h>
 #include <my-lib/exception.h>
+#include <my-lib/inline-function.h>
+#include <my-lib/slot-pool.h>
 
 namespace Mylib
 {
@@ -25,6 +33,18 @@ namespace Event
 
 // ---------------------------------------------------
 
+/*
+	Inline storage of the callbacks stored by the handlers (Handler, DenseHandler,
+	Timer and InterpolationManager).
+	Enough for lambdas with a few captures and for the objects made by
+	make_callback_object and make_callback_object_with_params (a few params).
+	Bigger callbacks are allocated by the memory manager of the handler.
+*/
+
+inline constexpr std::size_t default_callback_size = 48;
+
+// ---------------------------------------------------
+
 template <typename Tevent>
 class Callback
 {
@@ -187,58 +207,52 @@ auto make_callback_object_with_params (Tobj& obj, Tfunc callback, const Tfirst_p
 
 // ---------------------------------------------------
 
-template <typename Tevent>
+/*
+	Subscribing gives a Descriptor, which is a handle (SlotHandle) to a slot table
+	owned by the handler: 8 bytes, trivially copyable, and no allocation
+	besides the blocks of the table.
+	Use handler.is_valid(descriptor) to check if it is still subscribed.
+*/
+
+template <typename Tevent, std::size_t callback_size = default_callback_size>
 class Handler
 {
 public:
 	using Type = Tevent;
-	using EventCallback = Callback<Tevent>;
+	using EventCallback = InlineFunction<void (Tevent&), callback_size>;
 
 	struct Subscriber;
 
-	struct Descriptor__ {
-		Subscriber *subscriber = nullptr;
-	};
-
-	struct Descriptor {
-		std::shared_ptr<Descriptor__> shared_ptr;
+private:
+	using TallocSubscriber = Memory::AllocatorSTL<Subscriber>;
+	//using TallocSubscriber = typename std::allocator_traits<Talloc>::template rebind_alloc<Subscriber>;
+	using SubscriberList = std::list<Subscriber, TallocSubscriber>;
+	using DescriptorPool = SlotPool<typename SubscriberList::iterator>; // so we can erase the subscriber in O(1)
 
-		bool is_valid () const noexcept
-		{
-			return (this->shared_ptr && this->shared_ptr->subscriber != nullptr);
-		}
-	};
+public:
+	using Descriptor = typename DescriptorPool::Handle;
 
 	struct Subscriber {
 		Descriptor descriptor;
-		Memory::unique_ptr<EventCallback> callback; // used my unique_ptr to support polymorphic types
+		EventCallback callback; // stored inline, so subscribing doesn't allocate the callback separately
 	};
 
 private:
-	using TallocSubscriber = Memory::AllocatorSTL<Subscriber>;
-	//using TallocSubscriber = typename std::allocator_traits<Talloc>::template rebind_alloc<Subscriber>;
-
 	Memory::Manager *memory_manager;
-	std::list<Subscriber, TallocSubscriber> subscribers;
+	SubscriberList subscribers;
+	DescriptorPool descriptors;
 
 public:
 	Handler ()
-		: memory_manager(&Memory::default_manager),
-		  subscribers(TallocSubscriber(*memory_manager))
+		: Handler(Memory::default_manager)
 	{
 	}
 
 	Handler (Memory::Manager& memory_manager_)
 		: memory_manager(&memory_manager_),
-		  subscribers(TallocSubscriber(*memory_manager))
-	{
-	}
-
-	~Handler ()
+		  subscribers(TallocSubscriber(*memory_manager)),
+		  descriptors(*memory_manager)
 	{
-		for (auto& subscriber : this->subscribers) {
-			subscriber.descriptor.shared_ptr->subscriber = nullptr;
-		}
 	}
 
 	// delete copy constructor and assignment operator
@@ -253,10 +267,8 @@ public:
 	// This is useful for the timer, allowing us to re-schedule events.
 	void publish (Tevent& event)
 	{
-		for (auto& subscriber : this->subscribers) {
-			auto& c = *(subscriber.callback);
-			c(event);
-		}
+		for (auto& subscriber : this->subscribers)
+			subscriber.callback(event);
 	}
 
 	inline void publish (Tevent&& event)
@@ -272,50 +284,356 @@ public:
 	Descriptor subscribe (const Tcallback& callback)
 		//requires std::is_rvalue_reference<decltype(callback)>::value
 	{
-		using TallocatorDescriptor = Memory::AllocatorSTL<Descriptor__>;
-		TallocatorDescriptor descriptor_allocator(*this->memory_manager);
-
-		auto unique_ptr = Memory::make_unique<Tcallback>(*this->memory_manager, callback);
-
 		this->subscribers.push_back( Subscriber {
-			.callback = std::move(unique_ptr),
+			.callback = EventCallback(*this->memory_manager, callback),
 			} );
-		
-		Subscriber& subscriber = this->subscribers.back();
 
-		subscriber.descriptor = Descriptor {
-			.shared_ptr = std::allocate_shared<Descriptor__>(descriptor_allocator, Descriptor__ {
-				.subscriber = &subscriber
-			})
-		};
+		try {
+			Subscriber& subscriber = this->subscribers.back();
+			subscriber.descriptor = this->descriptors.create(std::prev(this->subscribers.end()));
+			return subscriber.descriptor;
+		}
+		catch (...) {
+			this->subscribers.pop_back();
+			throw;
+		}
+	}
 
-		return subscriber.descriptor;
+	bool is_valid (const Descriptor& descriptor) const noexcept
+	{
+		return this->descriptors.is_valid(descriptor);
 	}
 
+	/*
+		The descriptor must have been returned by this handler.
+		Don't unsubscribe inside publish, since the running callback may be erased.
+		DenseHandler supports it.
+	*/
+
 	void unsubscribe (Descriptor& descriptor)
 	{
-		bool found = false;
+		mylib_assert_exception(this->is_valid(descriptor), EventSubscriberNotFoundException)
+
+		this->erase(descriptor);
+	}
 
-		this->subscribers.remove_if(
-			[&descriptor, &found] (Subscriber& subscriber) -> bool {
-				const bool local_found = (descriptor.shared_ptr->subscriber == &subscriber);
+	/*
+		Unsubscribes all the descriptors.
+		If one of them is not valid, none is unsubscribed.
+		Repeated descriptors are unsubscribed once.
+	*/
 
-				if (local_found)
-					found = true;
-				
-				return local_found;
+	void unsubscribe_many (std::span<Descriptor> descriptors)
+	{
+		for (const Descriptor& descriptor : descriptors)
+			mylib_assert_exception(this->is_valid(descriptor), EventSubscriberNotFoundException)
+
+		for (Descriptor& descriptor : descriptors) {
+			if (this->is_valid(descriptor))
+				this->erase(descriptor);
+			else
+				descriptor = Descriptor();
+		}
+	}
+
+private:
+	void erase (Descriptor& descriptor)
+	{
+		this->subscribers.erase(this->descriptors[descriptor]);
+		this->descriptors.destroy(descriptor);
+		descriptor = Descriptor();
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Handler with the subscribers stored contiguously.
+
+	Handler keeps a std::list of subscribers, so publish jumps from node to node.
+	DenseHandler keeps the subscribers in a vector, with the callbacks
+	stored inline (InlineFunction), so publish just walks an array.
+
+	The descriptors are the same as in Handler.
+
+	Unsubscribe is O(1): the last subscriber is moved to the hole.
+	Therefore, the order the subscribers are called is not the
+	subscription order after an unsubscribe.
+
+	It is safe to subscribe and unsubscribe inside publish (from the callbacks).
+	Unsubscribed callbacks become tombstones, which are removed when the
+	outermost publish returns, so a callback can unsubscribe itself.
+	Subscribers created inside publish are only called in the next publish.
+*/
+
+template <typename Tevent, std::size_t callback_size = default_callback_size>
+class DenseHandler
+{
+public:
+	using Type = Tevent;
+
+private:
+	using DescriptorPool = SlotPool<uint32_t>; // index of the entry
+
+public:
+	using Descriptor = typename DescriptorPool::Handle;
+
+private:
+	using EventCallback = InlineFunction<void (Tevent&), callback_size>;
+
+	struct Entry {
+		EventCallback callback;
+		Descriptor descriptor;
+		bool alive; // false for tombstones
+	};
+
+	using TallocEntry = Memory::AllocatorSTL<Entry>;
+
+	Memory::Manager *memory_manager;
+	std::vector<Entry, TallocEntry> entries;
+	std::vector<Entry, TallocEntry> pending; // subscribed inside publish
+	DescriptorPool descriptors;
+	uint32_t publish_depth = 0;
+	uint32_t n_tombstones = 0;
+
+public:
+	DenseHandler ()
+		: DenseHandler(Memory::default_manager)
+	{
+	}
+
+	DenseHandler (Memory::Manager& memory_manager_)
+		: memory_manager(&memory_manager_),
+		  entries(TallocEntry(*memory_manager)),
+		  pending(TallocEntry(*memory_manager)),
+		  descriptors(*memory_manager)
+	{
+	}
+
+	DenseHandler (const DenseHandler&) = delete;
+	DenseHandler& operator= (const DenseHandler&) = delete;
+
+	DenseHandler (DenseHandler&&) = default;
+	DenseHandler& operator= (DenseHandler&&) = default;
+
+	void publish (Tevent& event)
+	{
+		struct Depth {
+			DenseHandler& handler;
+
+			Depth (DenseHandler& handler_)
+				: handler(handler_)
+			{
+				this->handler.publish_depth++;
 			}
-		);
 
-		mylib_assert_exception(found, EventSubscriberNotFoundException)
+			~Depth ()
+			{
+				if (--this->handler.publish_depth == 0 && (!this->handler.pending.empty() || this->handler.n_tombstones != 0)) [[unlikely]]
+					this->handler.flush();
+			}
+		};
+
+		Depth depth(*this);
+
+		// the vector is not changed inside publish, so the pointer stays valid
+		Entry *entries = this->entries.data();
+		const uint32_t n = this->entries.size();
+
+		for (uint32_t i = 0; i < n; i++) {
+			Entry& entry = entries[i];
 
-		descriptor.shared_ptr->subscriber = nullptr;
-		descriptor.shared_ptr.reset();
+			if (entry.alive) [[likely]]
+				entry.callback(event);
+		}
+	}
+
+	inline void publish (Tevent&& event)
+	{
+		this->publish(event);
+	}
+
+	template <typename Tcallback_>
+	Descriptor subscribe (Tcallback_&& callback)
+	{
+		static_assert(std::is_invocable_v<std::remove_cvref_t<Tcallback_>&, Tevent&>, "callback must be callable as void (Tevent&)");
+
+		auto& target = (this->publish_depth == 0) ? this->entries : this->pending;
+
+		// entries created inside publish are indexed after the current ones
+		const Descriptor descriptor = this->descriptors.create(this->entries.size() + this->pending.size());
+
+		try {
+			target.push_back( Entry {
+				.callback = EventCallback(*this->memory_manager, std::forward<Tcallback_>(callback)),
+				.descriptor = descriptor,
+				.alive = true
+			} );
+		}
+		catch (...) {
+			this->descriptors.destroy(descriptor);
+			throw;
+		}
+
+		return descriptor;
+	}
+
+	void unsubscribe (Descriptor& descriptor)
+	{
+		mylib_assert_exception(this->is_valid(descriptor), EventSubscriberNotFoundException)
+
+		const uint32_t index = this->descriptors[descriptor];
+
+		if (this->publish_depth == 0)
+			this->remove_entry(index);
+		else {
+			Entry& entry = (index < this->entries.size()) ? this->entries[index] : this->pending[index - this->entries.size()];
+			entry.alive = false; // the callback may be the one running, so we destroy it later
+			this->n_tombstones++;
+		}
+
+		this->descriptors.destroy(descriptor);
+		descriptor = Descriptor();
+	}
+
+	// Same as Handler::unsubscribe_many.
+	void unsubscribe_many (std::span<Descriptor> descriptors)
+	{
+		for (const Descriptor& descriptor : descriptors)
+			mylib_assert_exception(this->is_valid(descriptor), EventSubscriberNotFoundException)
+
+		for (Descriptor& descriptor : descriptors) {
+			if (this->is_valid(descriptor))
+				this->unsubscribe(descriptor);
+			else
+				descriptor = Descriptor();
+		}
+	}
+
+	bool is_valid (const Descriptor& descriptor) const noexcept
+	{
+		return this->descriptors.is_valid(descriptor);
+	}
+
+	uint32_t get_n_subscribers () const noexcept
+	{
+		return this->entries.size() + this->pending.size() - this->n_tombstones;
+	}
+
+private:
+	// moves the last entry to the hole
+	void remove_entry (const uint32_t index)
+	{
+		const uint32_t last = this->entries.size() - 1;
+
+		if (index != last) {
+			this->entries[index] = std::move(this->entries[last]);
+
+			// the descriptor of a tombstone is not valid anymore
+			if (this->entries[index].alive)
+				this->descriptors[this->entries[index].descriptor] = index;
+		}
+
+		this->entries.pop_back();
+	}
+
+	// called when the outermost publish returns
+	void flush ()
+	{
+		for (Entry& entry : this->pending)
+			this->entries.push_back(std::move(entry));
+
+		this->pending.clear();
+
+		if (this->n_tombstones == 0)
+			return;
+
+		for (uint32_t i = 0; i < this->entries.size(); ) {
+			if (!this->entries[i].alive)
+				this->remove_entry(i); // check again the one moved here
+			else
+				i++;
+		}
+
+		this->n_tombstones = 0;
 	}
 };
 
 // ---------------------------------------------------
 
+/*
+	Handler with the listeners fixed at compile time.
+
+	The listeners are stored by value in a tuple and publish calls each one
+	directly (fold expression), so there is no type erasure and the compiler
+	can inline the whole publish. The objects made by make_callback_* work too,
+	since their concrete type is known (the virtual call is devirtualized).
+
+	publish has the same signature as Handler::publish, so a hot event can
+	switch to StaticHandler without touching the callers.
+	There is no subscribe/unsubscribe.
+*/
+
+template <typename Tevent, typename... Listeners>
+class StaticHandler
+{
+public:
+	using Type = Tevent;
+
+	static_assert((std::is_invocable_v<Listeners&, Tevent&> && ...), "listeners must be callable as void (Tevent&)");
+
+private:
+	std::tuple<Listeners...> listeners;
+
+public:
+	constexpr StaticHandler ()
+		requires (std::is_default_constructible_v<Listeners> && ...)
+		= default;
+
+	constexpr explicit StaticHandler (Listeners... listeners_)
+		requires (sizeof...(Listeners) > 0)
+		: listeners(std::move(listeners_)...)
+	{
+	}
+
+	// called in the order of the template parameters
+	inline void publish (Tevent& event)
+	{
+		std::apply([&event] (Listeners&... listener) {
+			(std::invoke(listener, event), ...);
+		}, this->listeners);
+	}
+
+	inline void publish (Tevent&& event)
+	{
+		this->publish(event);
+	}
+
+	template <std::size_t i>
+	inline auto& get_listener () noexcept
+	{
+		return std::get<i>(this->listeners);
+	}
+
+	static consteval std::size_t get_n_subscribers () noexcept
+	{
+		return sizeof...(Listeners);
+	}
+};
+
+/*
+	Template parameter Tevent must be explicitly set.
+	auto handler = make_static_handler<int>(listener_1, listener_2);
+*/
+
+template <typename Tevent, typename... Listeners>
+auto make_static_handler (Listeners&&... listeners)
+{
+	return StaticHandler<Tevent, std::decay_t<Listeners>...>(std::forward<Listeners>(listeners)...);
+}
+
+// ---------------------------------------------------
+
 } // end namespace Event
 } // end namespace Mylib
 
@@ -0,0 +1,328 @@
+#ifndef __MY_LIB_INLINE_FUNCTION_HEADER_H__
+#define __MY_LIB_INLINE_FUNCTION_HEADER_H__
+
+#include <type_traits>
+#include <functional>
+#include <utility>
+#include <new>
+
+#include <cstdint>
+#include <cstddef>
+
+#include <my-lib/macros.h>
+#include <my-lib/std.h>
+#include <my-lib/exception.h>
+#include <my-lib/memory.h>
+
+namespace Mylib
+{
+
+// ---------------------------------------------------
+
+/*
+	Like std::function, but the size of the inline storage is chosen by the user.
+	Callables up to size() bytes are stored inside the InlineFunction,
+	so typical lambdas and member function bindings don't allocate memory.
+	Bigger callables (or with bigger alignment, or that may throw when moved)
+	are allocated by a Memory::Manager: the one given to the constructor,
+	or Memory::default_manager. Copies use the manager of the source.
+
+	The type is erased with a table of function pointers (one per callable type),
+	so an InlineFunction is the storage plus a single pointer,
+	and calling it is an indirect call, with no virtual dispatch.
+
+	Calling an empty InlineFunction is undefined behavior (it is not checked).
+*/
+
+template <typename Tsignature, std::size_t minimum_storage_size = 32, std::size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__>
+class InlineFunction;
+
+template <typename Treturn, typename... Args, std::size_t minimum_storage_size, std::size_t alignment>
+class MYLIB_ALIGN_STRUCT(alignment) InlineFunction<Treturn (Args...), minimum_storage_size, alignment>
+{
+public:
+	consteval static std::size_t size () noexcept
+	{
+		return ((minimum_storage_size % alignment) == 0)
+		? minimum_storage_size
+		: static_cast<std::size_t>((minimum_storage_size + alignment) / alignment) * alignment;
+	}
+
+	template <typename T>
+	static constexpr bool fits_inline () noexcept
+	{
+		return (sizeof(T) <= size())
+			&& (alignof(T) <= alignment)
+			&& std::is_nothrow_move_constructible_v<T>;
+	}
+
+private:
+	struct VTable {
+		Treturn (*invoke) (void *storage, Args... args);
+		void (*move) (void *source, void *target) noexcept; // also destroys the source
+		void (*copy) (const void *source, void *target); // nullptr if not copyable
+		void (*destroy) (void *storage) noexcept;
+	};
+
+	template <typename T>
+	struct InlineOps {
+		static T* get (void *storage) noexcept
+		{
+			return std::launder(reinterpret_cast<T*>(storage));
+		}
+
+		static Treturn invoke (void *storage, Args... args)
+		{
+			return std::invoke(*get(storage), std::forward<Args>(args)...);
+		}
+
+		static void move (void *source, void *target) noexcept
+		{
+			T *obj = get(source);
+			new (target) T(std::move(*obj));
+			obj->~T();
+		}
+
+		static void copy (const void *source, void *target)
+		{
+			new (target) T(*get(const_cast<void*>(source)));
+		}
+
+		static void destroy (void *storage) noexcept
+		{
+			get(storage)->~T();
+		}
+	};
+
+	// the storage keeps a pointer to the callable and the manager that allocated it
+	struct HeapPtr {
+		void *ptr;
+		Memory::Manager *manager;
+	};
+
+	static_assert(size() >= sizeof(HeapPtr), "the storage must fit at least two pointers");
+
+	template <typename T, typename... Types>
+	static T* heap_construct (Memory::Manager& manager, Types&&... vars)
+	{
+		T *ptr = manager.template allocate_type<T>(1);
+
+		try {
+			new (ptr) T(std::forward<Types>(vars)...);
+		}
+		catch (...) {
+			manager.template deallocate_type<T>(ptr, 1);
+			throw;
+		}
+
+		return ptr;
+	}
+
+	template <typename T>
+	struct HeapOps {
+		static HeapPtr& get_heap_ptr (void *storage) noexcept
+		{
+			return *std::launder(reinterpret_cast<HeapPtr*>(storage));
+		}
+
+		static T* get (void *storage) noexcept
+		{
+			return static_cast<T*>(get_heap_ptr(storage).ptr);
+		}
+
+		static Treturn invoke (void *storage, Args... args)
+		{
+			return std::invoke(*get(storage), std::forward<Args>(args)...);
+		}
+
+		static void move (void *source, void *target) noexcept
+		{
+			new (target) HeapPtr(get_heap_ptr(source));
+		}
+
+		static void copy (const void *source, void *target)
+		{
+			Memory::Manager& manager = *get_heap_ptr(const_cast<void*>(source)).manager;
+			T *ptr = heap_construct<T>(manager, *get(const_cast<void*>(source)));
+
+			new (target) HeapPtr { .ptr = ptr, .manager = &manager };
+		}
+
+		static void destroy (void *storage) noexcept
+		{
+			get_heap_ptr(storage).manager->template destruct_deallocate_type<T>(get(storage));
+		}
+	};
+
+	template <typename T>
+	using Ops = std::conditional_t<fits_inline<T>(), InlineOps<T>, HeapOps<T>>;
+
+	template <typename T>
+	static constexpr VTable make_vtable () noexcept
+	{
+		VTable vtable = {
+			.invoke = &Ops<T>::invoke,
+			.move = &Ops<T>::move,
+			.copy = nullptr,
+			.destroy = &Ops<T>::destroy
+		};
+
+		if constexpr (std::is_copy_constructible_v<T>)
+			vtable.copy = &Ops<T>::copy;
+
+		return vtable;
+	}
+
+	template <typename T>
+	static constexpr VTable vtable_for = make_vtable<T>();
+
+	alignas(alignment) std::byte storage[size()];
+	const VTable *vtable = nullptr; // nullptr means empty
+
+	template <typename T, typename... Types>
+	void construct (Memory::Manager& manager, Types&&... vars)
+	{
+		if constexpr (fits_inline<T>())
+			new (this->storage) T(std::forward<Types>(vars)...);
+		else
+			new (this->storage) HeapPtr { .ptr = heap_construct<T>(manager, std::forward<Types>(vars)...), .manager = &manager };
+
+		this->vtable = &vtable_for<T>;
+	}
+
+public:
+	InlineFunction () noexcept = default;
+
+	InlineFunction (std::nullptr_t) noexcept
+	{
+	}
+
+	template <typename T>
+	requires (!std::same_as<std::decay_t<T>, InlineFunction>
+		&& !std::same_as<std::decay_t<T>, std::nullptr_t>
+		&& std::is_invocable_r_v<Treturn, std::decay_t<T>&, Args...>)
+	InlineFunction (T&& callable)
+	{
+		this->construct<std::decay_t<T>>(Memory::default_manager, std::forward<T>(callable));
+	}
+
+	// the manager is only used if the callable doesn't fit inline
+	template <typename T>
+	requires (!std::same_as<std::decay_t<T>, InlineFunction>
+		&& !std::same_as<std::decay_t<T>, std::nullptr_t>
+		&& std::is_invocable_r_v<Treturn, std::decay_t<T>&, Args...>)
+	InlineFunction (Memory::Manager& manager, T&& callable)
+	{
+		this->construct<std::decay_t<T>>(manager, std::forward<T>(callable));
+	}
+
+	InlineFunction (const InlineFunction& other)
+	{
+		if (other.vtable == nullptr)
+			return;
+
+		mylib_assert_msg(other.vtable->copy != nullptr, "the callable of the InlineFunction is not copyable")
+
+		other.vtable->copy(other.storage, this->storage);
+		this->vtable = other.vtable;
+	}
+
+	InlineFunction (InlineFunction&& other) noexcept
+	{
+		if (other.vtable == nullptr)
+			return;
+
+		other.vtable->move(other.storage, this->storage);
+		this->vtable = other.vtable;
+		other.vtable = nullptr;
+	}
+
+	~InlineFunction ()
+	{
+		this->reset();
+	}
+
+	// -----------------------
+
+	InlineFunction& operator= (const InlineFunction& other)
+	{
+		if (this != &other) {
+			InlineFunction tmp(other);
+			*this = std::move(tmp);
+		}
+
+		return *this;
+	}
+
+	InlineFunction& operator= (InlineFunction&& other) noexcept
+	{
+		if (this != &other) {
+			this->reset();
+
+			if (other.vtable != nullptr) {
+				other.vtable->move(other.storage, this->storage);
+				this->vtable = other.vtable;
+				other.vtable = nullptr;
+			}
+		}
+
+		return *this;
+	}
+
+	InlineFunction& operator= (std::nullptr_t) noexcept
+	{
+		this->reset();
+		return *this;
+	}
+
+	template <typename T>
+	requires (!std::same_as<std::decay_t<T>, InlineFunction>
+		&& !std::same_as<std::decay_t<T>, std::nullptr_t>
+		&& std::is_invocable_r_v<Treturn, std::decay_t<T>&, Args...>)
+	InlineFunction& operator= (T&& callable)
+	{
+		this->reset();
+		this->construct<std::decay_t<T>>(Memory::default_manager, std::forward<T>(callable));
+		return *this;
+	}
+
+	// -----------------------
+
+	template <typename T, typename... Types>
+	void emplace (Types&&... vars)
+	{
+		this->reset();
+		this->construct<T>(Memory::default_manager, std::forward<Types>(vars)...);
+	}
+
+	void reset () noexcept
+	{
+		if (this->vtable != nullptr) {
+			this->vtable->destroy(this->storage);
+			this->vtable = nullptr;
+		}
+	}
+
+	bool has_value () const noexcept
+	{
+		return (this->vtable != nullptr);
+	}
+
+	explicit operator bool () const noexcept
+	{
+		return this->has_value();
+	}
+
+	// -----------------------
+
+	inline Treturn operator() (Args... args)
+	{
+		return this->vtable->invoke(this->storage, std::forward<Args>(args)...);
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Mylib
+
+#endif
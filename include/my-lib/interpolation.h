@@ -7,6 +7,8 @@
 #include <my-lib/event.h>
 #include <my-lib/coroutine.h>
 #include <my-lib/memory.h>
+#include <my-lib/inline-function.h>
+#include <my-lib/slot-pool.h>
 
 
 namespace Mylib
@@ -103,7 +105,7 @@ protected:
 
 // ---------------------------------------------------
 
-template <typename Coroutine, typename Tx>
+template <typename Coroutine, typename Tx, std::size_t callback_size = Mylib::Event::default_callback_size>
 class InterpolationManager
 {
 public:
@@ -111,25 +113,21 @@ public:
 	using PromiseType = typename Coroutine::promise_type;
 
 	struct Event {
-		Memory::unique_ptr<Interpolator<Tx>> interpolator;
+		Memory::compact_unique_ptr<Interpolator<Tx>> interpolator;
 	};
 
-	struct Descriptor__ {
-		Event *ptr;
-	};
-
-	struct Descriptor {
-		std::shared_ptr<Descriptor__> shared_ptr;
+private:
+	struct EventFull;
+	using DescriptorPool = SlotPool<EventFull*>;
 
-		bool is_valid () const noexcept
-		{
-			return (this->shared_ptr && this->shared_ptr->ptr != nullptr);
-		}
-	};
+public:
+	// Same as the timer descriptors.
+	// Valid (manager.is_valid) until the interpolation finishes or is removed.
+	using Descriptor = typename DescriptorPool::Handle;
 
 	struct CoroutineAwaiter {
 		InterpolationManager& interpolation_manager;
-		Memory::unique_ptr<Interpolator<Tx>> interpolator;
+		Memory::compact_unique_ptr<Interpolator<Tx>> interpolator;
 		CoroutineHandle handler;
 
 		// await_ready is called before the coroutine is suspended.
@@ -180,11 +178,11 @@ public:
 	friend struct CoroutineAwaiter;
 
 private:
-	using InterpolatorCallback = Mylib::Event::Callback<Event>;
+	using InterpolatorCallback = InlineFunction<void (Event&), callback_size>;
 
 	struct EventCallback {
 		Descriptor descriptor;
-		Memory::unique_ptr<InterpolatorCallback> callback;
+		InterpolatorCallback callback; // may be empty
 	};
 
 	struct EventCoroutine {
@@ -198,15 +196,18 @@ private:
 
 	Memory::Manager& memory_manager;
 	std::vector<EventFull*> interpolators;
+	DescriptorPool descriptors;
 
 public:
 	InterpolationManager ()
-		: memory_manager(Memory::default_manager)
+		: memory_manager(Memory::default_manager),
+		  descriptors(memory_manager)
 	{
 	}
 
 	InterpolationManager (Memory::Manager& memory_manager_)
-		: memory_manager(memory_manager_)
+		: memory_manager(memory_manager_),
+		  descriptors(memory_manager)
 	{
 	}
 
@@ -225,10 +226,8 @@ public:
 				if (std::holds_alternative<EventCallback>(event->var_callback)) {
 					EventCallback& callback = std::get<EventCallback>(event->var_callback);
 
-					if (callback.callback) {
-						auto& c = *(callback.callback);
-						c(*event);
-					}
+					if (callback.callback)
+						callback.callback(*event);
 				}
 				else if (std::holds_alternative<EventCoroutine>(event->var_callback)) {
 					EventCoroutine& event_coro = std::get<EventCoroutine>(event->var_callback);
@@ -244,34 +243,42 @@ public:
 	template <typename Ty>
 	Descriptor interpolate_linear (const Tx max_x_, Ty *target_, const Ty start_y_, const Ty end_y_)
 	{
-		auto unique_ptr_interpolator = Memory::make_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
+		auto unique_ptr_interpolator = Memory::make_compact_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
 		return this->add_interpolator_callback(std::move(unique_ptr_interpolator), nullptr);
 	}
 
 	template <typename Ty, typename Tcallback>
 	Descriptor interpolate_linear (const Tx max_x_, Ty *target_, const Ty start_y_, const Ty end_y_, const Tcallback& callback)
 	{
-		auto unique_ptr_callback = Memory::make_unique<Tcallback>(this->memory_manager, callback);
-		auto unique_ptr_interpolator = Memory::make_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
-		return this->add_interpolator_callback(std::move(unique_ptr_interpolator), std::move(unique_ptr_callback));
+		auto unique_ptr_interpolator = Memory::make_compact_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
+		return this->add_interpolator_callback(std::move(unique_ptr_interpolator), InterpolatorCallback(this->memory_manager, callback));
 	}
 
 	template <typename Ty>
 	CoroutineAwaiter coroutine_wait_interpolate_linear (const Tx max_x_, Ty *target_, const Ty start_y_, const Ty end_y_)
 	{
-		auto unique_ptr_interpolator = Memory::make_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
+		auto unique_ptr_interpolator = Memory::make_compact_unique<LinearInterpolator<Tx, Ty>>(this->memory_manager, max_x_, target_, start_y_, end_y_);
 		return CoroutineAwaiter {
 			.interpolation_manager = *this,
 			.interpolator = std::move(unique_ptr_interpolator)
 		};
 	}
 
+	inline bool is_valid (const Descriptor& descriptor) const noexcept
+	{
+		return this->descriptors.is_valid(descriptor);
+	}
+
 	inline void remove_interpolator (Descriptor& descriptor)
 	{
-		EventFull *event = static_cast<EventFull*>(descriptor.ptr);
+		EventFull **event_ptr = this->descriptors.get(descriptor);
+
+		mylib_assert_msg(event_ptr != nullptr, "removing an invalid interpolator descriptor")
+
+		EventFull *event = *event_ptr;
 		this->pop(event);
-		this->destroy_event(event);
-		descriptor.shared_ptr.reset();
+		this->destroy_event(event); // also destroys the descriptor
+		descriptor = Descriptor();
 	}
 
 	inline void force_resume_coroutine (Coroutine coro)
@@ -304,7 +311,7 @@ private:
 	{
 		if (std::holds_alternative<EventCallback>(event->var_callback)) {
 			EventCallback& callback = std::get<EventCallback>(event->var_callback);
-			callback.descriptor.shared_ptr->ptr = nullptr;
+			this->descriptors.destroy(callback.descriptor);
 		}
 		this->memory_manager.template destruct_deallocate_type<EventFull>(event);
 	}
@@ -332,26 +339,27 @@ private:
 		this->pop(event->vector_pos);
 	}
 
-	Descriptor add_interpolator_callback (Memory::unique_ptr<Interpolator<Tx>> interpolator, Memory::unique_ptr<InterpolatorCallback> callback_copy)
+	Descriptor add_interpolator_callback (Memory::compact_unique_ptr<Interpolator<Tx>> interpolator, InterpolatorCallback callback_copy)
 	{
-		using TallocatorDescriptor = Memory::AllocatorSTL<Descriptor__>;
-		TallocatorDescriptor descriptor_allocator(this->memory_manager);
-
 		EventFull *event = this->memory_manager.template allocate_construct_type<EventFull>();
 
-		std::shared_ptr<Descriptor__> shared_ptr_ = std::allocate_shared<Descriptor__>(descriptor_allocator, Descriptor__ {
-			.ptr = event
-		});
+		try {
+			const Descriptor descriptor = this->descriptors.create(event);
 
-		event->interpolator = std::move(interpolator);
-		event->var_callback = EventCallback {
-			.descriptor = Descriptor { .shared_ptr = shared_ptr_ },
-			.callback = std::move(callback_copy),
-		},
+			event->interpolator = std::move(interpolator);
+			event->var_callback = EventCallback {
+				.descriptor = descriptor,
+				.callback = std::move(callback_copy),
+			},
 
-		this->push(event);
-		
-		return Descriptor { .shared_ptr = std::move(shared_ptr_) };
+			this->push(event);
+
+			return descriptor;
+		}
+		catch (...) {
+			this->destroy_event(event); // also destroys the descriptor, if already created
+			throw;
+		}
 	}
 };
 
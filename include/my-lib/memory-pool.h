@@ -5,12 +5,40 @@
 #include <initializer_list>
 #include <vector>
 #include <span>
-//#include <mutex>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+#include <bit>
+#include <limits>
+#include <map>
+#include <array>
+#include <algorithm>
+#include <functional>
+#include <bitset>
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <cassert>
 
+#if defined(__SANITIZE_ADDRESS__)
+	#define MYLIB_MEMORY_ASAN
+#elif defined(__has_feature)
+	#if __has_feature(address_sanitizer)
+		#define MYLIB_MEMORY_ASAN
+	#endif
+#endif
+
+#if defined(MYLIB_MEMORY_ASAN)
+	#include <sanitizer/asan_interface.h>
+#endif
+
+#if __has_include(<valgrind/memcheck.h>)
+	#include <valgrind/memcheck.h>
+	#define MYLIB_MEMORY_VALGRIND
+#endif
+
 #include <my-lib/macros.h>
 #include <my-lib/std.h>
 #include <my-lib/memory.h>
@@ -34,6 +62,117 @@ namespace Memory
 // ---------------------------------------------------
 
 inline constexpr size_t default_block_size = 16 * 1024; // 16KB
+inline constexpr size_t huge_page_size = 2 * 1024 * 1024; // 2MB
+inline constexpr size_t segment_size = 64 * 1024; // 64KB
+inline constexpr size_t cache_line_size = 64;
+
+// ---------------------------------------------------
+
+enum class BlockGrowth : uint8_t {
+	Fixed,    // all blocks have the same size
+	Doubling  // each new block has twice the chunks of the previous one, up to max_block_size
+};
+
+enum class BlockBackend : uint8_t {
+	Heap,     // m_allocate
+	HugePages, // mmap + MADV_HUGEPAGE on Linux, blocks are rounded up to 2MB. Falls back to Heap on other systems.
+	Segments   // aligned_alloc, blocks are rounded up to segment_size and registered in the segment_map (see SegmentMap)
+};
+
+// Only supported on Linux, ignored on other systems.
+// The binding is a preference (MPOL_PREFERRED), so the allocation doesn't fail when the node is full.
+// Bound blocks are always mmap'ed (whatever the backend, rounded up to whole pages)
+// and bound before anything is written to them, so all of their pages go to the node.
+
+enum class NumaBinding : uint8_t {
+	None,      // the kernel decides (usually the node of the thread that first touches the memory)
+	LocalNode, // blocks are bound to the node of the thread that allocates them
+	Node       // blocks are bound to BlockPolicy::numa_node
+};
+
+struct BlockPolicy {
+	BlockGrowth growth = BlockGrowth::Fixed;
+	BlockBackend backend = BlockBackend::Heap;
+	size_t max_block_size = 4 * 1024 * 1024; // only used by BlockGrowth::Doubling
+
+	// Block coloring: the chunks of the i-th block start (i % n_colors) cache lines
+	// after the beginning of the block. 1 disables it.
+	uint32_t n_colors = 1;
+
+	NumaBinding numa = NumaBinding::None;
+	uint32_t numa_node = 0; // only used by NumaBinding::Node
+};
+
+// Number of NUMA nodes of the system, 1 when it isn't NUMA or not supported.
+uint32_t get_numa_n_nodes ();
+
+// Node of the CPU the calling thread is running on.
+uint32_t get_numa_current_node ();
+
+// A size class with its own alignment.
+// The chunks are padded to a multiple of align, so align = cache_line_size
+// gives each object its own cache lines (no false sharing between them).
+
+struct SizeClass {
+	size_t size;
+	size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+};
+
+// ---------------------------------------------------
+
+class PoolCore;
+
+/*
+	Global map from the address of a segment (segment_size aligned memory)
+	to the PoolCore that owns it.
+	It allows us to find the pool of a chunk in O(1) without knowing its size,
+	and to know that a pointer doesn't belong to any pool.
+
+	It is a two-level radix tree over the 48-bit address space.
+	The root is a static array, and the leaves are allocated on demand
+	with calloc (not operator new, since operator new may be the pool itself)
+	and never released.
+
+	Updates and lookups are lock-free, so different pools can register their
+	segments from different threads.
+*/
+
+class SegmentMap
+{
+private:
+	static constexpr uint32_t address_bits = 48;
+	static constexpr uint32_t segment_bits = std::countr_zero(segment_size);
+	static constexpr uint32_t leaf_bits = 16;
+	static constexpr uint32_t root_bits = address_bits - segment_bits - leaf_bits;
+	static constexpr uintptr_t leaf_mask = (static_cast<uintptr_t>(1) << leaf_bits) - 1;
+
+	static_assert(std::has_single_bit(segment_size));
+
+	std::atomic<PoolCore**> root[static_cast<size_t>(1) << root_bits] = {};
+
+public:
+	inline PoolCore* find (const void *p) const noexcept
+	{
+		const uintptr_t segment = reinterpret_cast<uintptr_t>(p) >> segment_bits;
+		const uintptr_t root_i = segment >> leaf_bits;
+
+		if (root_i >= std::size(this->root)) [[unlikely]]
+			return nullptr;
+
+		PoolCore **leaf = this->root[root_i].load(std::memory_order_acquire);
+
+		if (leaf == nullptr)
+			return nullptr;
+
+		return std::atomic_ref<PoolCore*>(leaf[segment & leaf_mask]).load(std::memory_order_acquire);
+	}
+
+	// p and size must be segment_size aligned
+	void insert (const void *p, const size_t size, PoolCore *pool);
+	void erase (const void *p, const size_t size);
+};
+
+inline SegmentMap segment_map;
 
 // ---------------------------------------------------
 
@@ -48,21 +187,69 @@ private:
 	};
 
 	struct Block {
+		uint8_t *memory; // beginning of the allocated memory, the chunks start after the color offset
 		Chunk *chunks;
+		size_t size; // in bytes
+		uint32_t n_chunks;
 		
 		// When we use all the allocted memory, we allocate another block.
+		Block *previous_block;
 		Block *next_block;
+
+		// Only used by trim.
+		// Free chunks that trim moved out of the free_chunks list, back to their block.
+		// When all the chunks of a block are here, the block can be released.
+		// Blocks that have such chunks are in the partial_blocks list.
+		Chunk *free_chunks;
+		uint32_t n_free_chunks;
+		Block *previous_partial_block;
+		Block *next_partial_block;
 	};
 
 	const size_t type_size;
-	const uint32_t chunks_per_block;
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(uint32_t, chunks_per_block) // of the first block
 	const size_t align;
 
 	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, chunk_size)
 
+	const BlockPolicy block_policy;
+	uint32_t next_block_chunks;
+	uint32_t next_color = 0;
+
+	MYLIB_OO_ENCAPSULATE_SCALAR_INIT_READONLY(uint32_t, n_blocks, 0)
+
 	Block *blocks = nullptr;
 	Chunk *free_chunks = nullptr;
 
+	// Chunks of the newest block that were never used.
+	// Instead of building the free list of a new block right away
+	// (which touches the whole block), we serve them with a bump pointer
+	// when the free list is empty.
+	// This way, a new block costs O(1) and memory is only touched on demand.
+	uint8_t *untouched_chunks = nullptr;
+	uint8_t *untouched_chunks_end = nullptr;
+	Block *untouched_block = nullptr;
+
+	// Runs of contiguous chunks freed by deallocate_contiguous, by length.
+	// free_runs[count] is a list of runs of count chunks, linked by their first chunk.
+	// allocate_contiguous takes them before carving new chunks,
+	// and they are broken into single chunks when the free list needs them (refill, trim).
+	// Adjacent runs are merged when none of them is long enough (see coalesce_free_runs).
+	std::vector<Chunk*> free_runs;
+	uint32_t n_free_runs = 0;
+	size_t n_free_run_chunks = 0;
+
+	// Used by trim to find the block of a chunk.
+	Block *partial_blocks = nullptr;
+	// Sorted by address, updated when a block is allocated or released,
+	// so trim never has to rebuild it (its size is n_blocks).
+	// Like the segment_map, it is malloc'ed instead of a std::vector,
+	// since operator new may be served by this very pool (see memory-pool-new.cpp).
+	Block **blocks_index = nullptr;
+	uint32_t blocks_index_capacity = 0;
+
+	MYLIB_MEMORY_STATS_RUN( SizeClassStats stats; )
+
 	// The mutex had a huge impact on performance.
 	// Let's leave it off while I try to find a better solution.
 	// One possible solution is to have an allocator per thread.
@@ -70,7 +257,7 @@ private:
 	//std::mutex mutex;
 
 public:
-	PoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_);
+	PoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_, const BlockPolicy& block_policy_ = BlockPolicy());
 	~PoolCore ();
 
 	// allocates one element of size chunk_size
@@ -81,12 +268,24 @@ public:
 
 		//this->mutex.lock();
 
-		if (this->free_chunks == nullptr) [[unlikely]]
-			this->alloc_new_block();
+		if (this->free_chunks == nullptr) [[unlikely]] {
+			if (this->untouched_chunks == this->untouched_chunks_end) [[unlikely]]
+				this->refill();
+
+			// refill may give us back the chunks kept by trim instead of a new block
+			if (this->free_chunks == nullptr) {
+				free_chunk = this->untouched_chunks;
+				this->untouched_chunks += this->chunk_size;
+				MYLIB_MEMORY_STATS_RUN( this->stats_allocated(1, 1); )
+				return free_chunk;
+			}
+		}
 
 		free_chunk = this->free_chunks;
 		this->free_chunks = this->free_chunks->next_chunk;
 
+		MYLIB_MEMORY_STATS_RUN( this->stats_allocated(1, 1); )
+
 		//this->mutex.unlock();
 
 		return free_chunk;
@@ -104,17 +303,149 @@ public:
 		chunk->next_chunk = this->free_chunks;
 		this->free_chunks = chunk;
 
+		MYLIB_MEMORY_STATS_RUN( this->stats_deallocated(1, 1); )
+
 		//this->mutex.unlock();
 	}
 
+	// allocates ptrs.size() elements of size chunk_size at once
+
+	inline void allocate_bulk (std::span<void*> ptrs)
+	{
+		const size_t n = ptrs.size();
+		size_t i = 0;
+
+		while (true) {
+			// We walk the free list and detach the whole sublist at once.
+
+			Chunk *chunk = this->free_chunks;
+
+			// No prefetch here: the address of the next chunk is only known
+			// when we load it, so there is nothing to fetch ahead of time.
+
+			for (; i < n && chunk != nullptr; i++) {
+				ptrs[i] = chunk;
+				chunk = chunk->next_chunk;
+			}
+
+			this->free_chunks = chunk;
+
+			// Then, the remaining ones come from the untouched chunks.
+
+			for (; i < n && this->untouched_chunks != this->untouched_chunks_end; i++) {
+				ptrs[i] = this->untouched_chunks;
+				this->untouched_chunks += this->chunk_size;
+			}
+
+			if (i == n) [[likely]]
+				break;
+
+			this->refill();
+		}
+
+		MYLIB_MEMORY_STATS_RUN( this->stats_allocated(n, 1); )
+	}
+
+	// free ptrs.size() elements of size chunk_size at once
+
+	inline void deallocate_bulk (std::span<void*> ptrs)
+	{
+		if (ptrs.empty()) [[unlikely]]
+			return;
+
+		// We link the chunks among themselves,
+		// and splice the whole list as the new head of free_chunks.
+
+		const size_t last = ptrs.size() - 1;
+
+		for (size_t i = 0; i < last; i++)
+			static_cast<Chunk*>(ptrs[i])->next_chunk = static_cast<Chunk*>(ptrs[i + 1]);
+
+		static_cast<Chunk*>(ptrs[last])->next_chunk = this->free_chunks;
+		this->free_chunks = static_cast<Chunk*>(ptrs[0]);
+
+		MYLIB_MEMORY_STATS_RUN( this->stats_deallocated(ptrs.size(), 1); )
+	}
+
+	// allocates count contiguous chunks
+	// if count > chunks_per_block, it is forwarded to m_allocate
+
+	[[nodiscard]] void* allocate_contiguous (const uint32_t count);
+	void deallocate_contiguous (void *p, const uint32_t count);
+
+	// Makes sure the next n allocations don't need to allocate a block.
+	// Useful to pre-size the pool at startup, out of the hot path.
+
+	void reserve (const uint32_t n);
+
+	/*
+		Releases the blocks that have no allocated chunks.
+
+		Trim moves the free chunks out of the free_chunks list, back to a per-block list,
+		counting the free chunks of each block.
+		When all the chunks of a block are free, the block is released.
+		The chunks of the blocks that are still in use are given back
+		to the free list only when the free list gets empty.
+
+		max_chunks limits the number of free chunks processed per call,
+		so trim can be called incrementally from a frame/tick loop.
+		The next call continues from where the last one stopped.
+		Returns the number of free chunks processed.
+		When it returns less than max_chunks, there is nothing else to trim.
+	*/
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max());
+
+	void shrink_to_fit ()
+	{
+		this->trim();
+	}
+
 	static constexpr size_t lowest_chunk_size () noexcept
 	{
 		return sizeof(void*);
 	}
 
+#ifdef MYLIB_MEMORY_STATS
+	SizeClassStats get_size_class_stats () const;
+	Stats get_stats () const;
+
+	// The pool only knows its own type_size.
+	// Managers on top of it use this to account the size that was actually requested.
+	inline void stats_add_requested (const size_t bytes) noexcept
+	{
+		this->stats.requested_bytes += bytes; // may "wrap around" to subtract
+	}
+#endif
+
 private:
-	void alloc_new_block ();
-	void alloc_chunks_for_block (Block *block);
+#ifdef MYLIB_MEMORY_STATS
+	inline void stats_allocated (const uint64_t n_allocations, const uint32_t n_chunks) noexcept
+	{
+		this->stats.counters.allocated(n_allocations * n_chunks * this->chunk_size, n_allocations);
+		this->stats.requested_bytes += n_allocations * n_chunks * this->type_size;
+	}
+
+	inline void stats_deallocated (const uint64_t n_allocations, const uint32_t n_chunks) noexcept
+	{
+		this->stats.counters.deallocated(n_allocations * n_chunks * this->chunk_size, n_allocations);
+		this->stats.requested_bytes -= n_allocations * n_chunks * this->type_size;
+	}
+#endif
+
+	void refill ();
+	void alloc_new_block (const uint32_t min_chunks = 0);
+	void grow_blocks_index ();
+	void retire_untouched_chunks ();
+	void push_free_run (void *p, const uint32_t count);
+	void* pop_free_run (const uint32_t count);
+	bool break_free_run ();
+	void coalesce_free_runs ();
+	Block* find_block (const Chunk *chunk);
+	void release_block (Block *block);
+	void free_block (Block *block);
+	void link_partial_block (Block *block);
+	void unlink_partial_block (Block *block);
 };
 
 // ---------------------------------------------------
@@ -141,131 +472,1414 @@ public:
 
 // ---------------------------------------------------
 
-class PoolManager : public Manager
+/*
+	Lock-free version of PoolCore, with the same API.
+	It can be shared by multiple threads.
+
+	The free_chunks list is a Treiber stack.
+	To avoid the ABA problem, the head pointer is tagged with a counter
+	that is incremented at every update.
+	We pack the pointer (48 bits) and the counter (16 bits) in 64 bits,
+	so a simple CAS is enough (no need for double-word CAS).
+
+	The pointers must fit in 48 bits, which is checked for every block.
+	Kernels with 5-level paging (57-bit user addresses) only hand out
+	such addresses when asked for (mmap hint above 47 bits), but if the
+	check fails, alloc_new_block throws instead of corrupting the list.
+
+	The tag only has 16 bits, so it wraps around after 65536 updates.
+	ABA is still possible if a thread is stalled between reading the head
+	and its CAS while exactly a multiple of 65536 updates happen and the
+	same chunk is back at the head. Unlikely, but not impossible.
+
+	Only alloc_new_block takes a lock, and only one thread
+	allocates a new block when the free list gets empty.
+
+	In allocate, we may read the next_chunk of a chunk that was just
+	popped by another thread (and is now being used to store user data).
+	This is fine, because the memory is never released while the pool
+	exists, and the CAS fails since the tag was changed.
+*/
+
+class ConcurrentPoolCore
 {
 private:
-	// Maximum type_size handled by the allocator.
-	// Any size greater than it will be directly forwarded to malloc/free.
-	size_t max_type_size;
-	
-	std::vector<PoolCore*> allocators;
-	std::vector<PoolCore*> allocators_index;
+	struct Chunk {
+		Chunk *next_chunk;
+	};
 
-	void load (std::vector<size_t>& list_type_sizes, const size_t max_block_size);
+	struct Block {
+		Chunk *chunks;
+		Block *next_block;
+	};
+
+	static constexpr uint32_t pointer_bits = 48;
+	static constexpr uint64_t pointer_mask = (static_cast<uint64_t>(1) << pointer_bits) - 1;
+
+	const size_t type_size;
+	const uint32_t chunks_per_block;
+	const size_t align;
+
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, chunk_size)
+
+	std::atomic<uint64_t> free_chunks = 0; // tagged pointer
+	Block *blocks = nullptr; // protected by block_mutex
+	std::mutex block_mutex;
 
 public:
-	// max_block_size: max amount of memory to be allocated per malloc
-	PoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size = default_block_size);
-	PoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size = default_block_size);
-	PoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size = default_block_size);
+	ConcurrentPoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_);
+	~ConcurrentPoolCore ();
 
-	~PoolManager ();
+	MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(ConcurrentPoolCore)
 
-	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	// allocates one element of size chunk_size
+
+	[[nodiscard]] inline void* allocate ()
 	{
-		mylib_assert_exception_args(count == 1, PoolAllocatorMultiException, type_size, count, align);
-//std::cout << "allocating..." << std::endl;
+		uint64_t head = this->free_chunks.load(std::memory_order_acquire);
 
-		void *p;
+		while (true) {
+			Chunk *chunk = untag_pointer(head);
 
-		if (type_size <= this->max_type_size) [[likely]]
-			p = this->allocators_index[type_size]->allocate();
-		else
-			p = m_allocate(type_size, align);
+			if (chunk == nullptr) [[unlikely]] {
+				this->alloc_new_block();
+				head = this->free_chunks.load(std::memory_order_acquire);
+				continue;
+			}
 
-		return p;
+			if (this->free_chunks.compare_exchange_weak(head, tag_pointer(chunk->next_chunk, head), std::memory_order_acquire, std::memory_order_acquire)) [[likely]]
+				return chunk;
+		}
 	}
 
-	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	// free one element of size chunk_size
+
+	inline void deallocate (void *p)
 	{
-		mylib_assert_exception_args(count == 1, PoolAllocatorMultiException, type_size, count, align);
-//std::cout << "deallocating..." << std::endl;
+		Chunk *chunk = static_cast<Chunk*>(p);
+		uint64_t head = this->free_chunks.load(std::memory_order_relaxed);
 
-		if (type_size <= this->max_type_size) [[likely]]
-			this->allocators_index[type_size]->deallocate(p);
-		else
-			m_deallocate(p, type_size, align);
+		do {
+			chunk->next_chunk = untag_pointer(head);
+		} while (!this->free_chunks.compare_exchange_weak(head, tag_pointer(chunk, head), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	static constexpr size_t lowest_chunk_size () noexcept
+	{
+		return sizeof(void*);
+	}
+
+private:
+	static inline Chunk* untag_pointer (const uint64_t tagged) noexcept
+	{
+		return reinterpret_cast<Chunk*>(tagged & pointer_mask);
+	}
+
+	// builds a new tagged pointer, with the counter of the old one incremented
+	static inline uint64_t tag_pointer (Chunk *chunk, const uint64_t old_tagged) noexcept
+	{
+		const uint64_t tag = (old_tagged >> pointer_bits) + 1;
+		return (tag << pointer_bits) | (reinterpret_cast<uint64_t>(chunk) & pointer_mask);
 	}
+
+	void alloc_new_block ();
 };
 
 // ---------------------------------------------------
 
-// still under development
+/*
+	Thread-safe front-end for PoolCore.
+
+	Each thread gets its own cache (magazine) of free chunks, so the
+	common allocate/deallocate path doesn't need any lock.
+	Only when the cache is empty (or too full), we lock the shared
+	PoolCore to move a whole batch of chunks at once.
+
+	Each chunk has a small header storing the cache (thread) that allocated it.
+	When a chunk is freed by another thread, it is pushed into a lock-free
+	queue of the owner cache (remote_chunks), which is drained by the owner
+	thread when its local cache gets empty.
+
+	The caches are owned by the pool and only destroyed together with it,
+	since chunks still in use may point to them.
+	When a thread finishes, a thread_local destructor gives the chunks of
+	its caches back to the shared pool, and the caches become orphans.
+	A new thread adopts an orphan cache instead of creating a new one.
+	Chunks freed to an orphan cache are given back to the shared pool
+	by the next refill.
+	Using the pool from a thread_local destructor that runs after ours
+	is not supported.
+*/
 
-#if 0
-class datablock_general_alloc_t
+class ThreadCachedPoolCore
 {
-public:
-	using size_t = size_t;
-
 private:
-	enum class block_status_t {
-		free,
-		occupied
+	struct ThreadCache;
+
+	union Chunk {
+		// When the chunk is allocated, the header stores the owner cache.
+		// When the chunk is free, the header stores the free list.
+		ThreadCache *owner;
+		Chunk *next_chunk;
 	};
 
-	/*
-		This class handle chunks differently from Core.
-		In Core, the pre-allocated chunks:
-			- when a block is free, it stores a linked list of free chunks;
-			- when a blodk is occupied, it is 100% used (except when
-			  element size < sizeof(void*)) to store the payload.
-		Therefore, when a block is occupied, no memory is "wasted".
-		The block and payload occupies the same address.
-
-		However, this class (datablock_general_alloc_t) can't work like that,
-		because I decided to keep a permanent double-linked list for each chunk's chunks.
-		The reason is that I want to be abl to merge consecutive free chunks into one
-		when a deallocation is performed, in order to reduce fragmentation.
-		Therefore, each block first contains its metadata (Chunk), followed by the payload.
-	*/
+	struct MYLIB_ALIGN_STRUCT(64) ThreadCache {
+		Chunk *local_chunks = nullptr;
+		uint32_t n_local_chunks = 0;
 
-	struct Block;
+		// Chunks freed by other threads.
+		// Multiple producers (push) and a single consumer (exchange).
+		// Since the consumer always takes the whole list, there is no ABA problem.
+		std::atomic<Chunk*> remote_chunks = nullptr;
 
-	struct Chunk {
-		Block *chunk;
-		Chunk *left;
-		Chunk *right;
-		Chunk *previous_free_block;
-		Chunk *next_free_block;
-		size_t payload_capacity;
-		block_status_t status;
+		inline void push_remote (Chunk *chunk) noexcept
+		{
+			Chunk *head = this->remote_chunks.load(std::memory_order_relaxed);
+
+			do {
+				chunk->next_chunk = head;
+			} while (!this->remote_chunks.compare_exchange_weak(head, chunk, std::memory_order_release, std::memory_order_relaxed));
+		}
 	};
 
-	struct Block {
-		Chunk *chunks;
-		Block *next_chunk;
-		uint32_t chunk_size; // chunk_size can be higher than target_chunk_size to allow large allocations
+	struct ThreadCacheSlot {
+		uint64_t pool_id = 0;
+		ThreadCache *cache = nullptr;
+	};
+
+	struct ThreadCacheBinding {
+		uint64_t pool_id;
+		ThreadCachedPoolCore *pool;
+		ThreadCache *cache;
+	};
+
+	// All the caches used by a thread, of all pools.
+	// The destructor runs when the thread finishes and gives them back to their pools.
+	struct ThreadCacheBindings {
+		std::vector<ThreadCacheBinding> list;
+
+		~ThreadCacheBindings ();
 	};
 
-	Block *chunks;
-	Chunk *free_chunks;
+	static constexpr uint32_t n_thread_cache_slots = 16;
+
+	// Small direct-mapped table to find the thread cache of a pool without locking.
+	// We use a pool id instead of the pool address because a new pool may
+	// be created in the same address of a destroyed one.
+	// Pools whose ids collide (pool_id % n_thread_cache_slots) evict each other's slot,
+	// but a miss only scans the bindings of the thread, which also doesn't lock.
+	static thread_local ThreadCacheSlot thread_cache_slots[n_thread_cache_slots];
+	static thread_local ThreadCacheBindings thread_cache_bindings;
+	static std::atomic<uint64_t> next_pool_id;
+
+	const uint64_t pool_id;
+	const size_t header_size;
+	const uint32_t batch_size;
 
-	OO_ENCAPSULATE_READONLY(size_t, target_chunk_size)
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, type_size)
+
+	PoolCore central;
+	std::mutex mutex; // protects central, caches and orphan_caches
+	std::vector<ThreadCache*> caches; // all of them, deleted together with the pool
+	std::vector<ThreadCache*> orphan_caches; // caches of finished threads
 
 public:
-	datablock_general_alloc_t (size_t target_chunk_size=(1024*128));
-	~datablock_general_alloc_t ();
+	// batch_size: number of chunks moved between the thread cache and the shared pool at a time
+	ThreadCachedPoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_, const uint32_t batch_size_ = 64);
+	~ThreadCachedPoolCore ();
+
+	MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(ThreadCachedPoolCore)
+
+	uint32_t get_n_blocks ();
+	uint32_t get_n_thread_caches ();
+
+	[[nodiscard]] inline void* allocate ()
+	{
+		ThreadCache& cache = this->get_thread_cache();
+
+		if (cache.local_chunks == nullptr) [[unlikely]]
+			this->refill(cache);
+
+		Chunk *chunk = cache.local_chunks;
+		cache.local_chunks = chunk->next_chunk;
+		cache.n_local_chunks--;
 
-	void* alloc (size_t size);
-	void release (void *p);
+		chunk->owner = &cache;
 
+		return reinterpret_cast<uint8_t*>(chunk) + this->header_size;
+	}
+
+	inline void deallocate (void *p)
+	{
+		Chunk *chunk = reinterpret_cast<Chunk*>(static_cast<uint8_t*>(p) - this->header_size);
+		ThreadCache *owner = chunk->owner;
+		ThreadCache& cache = this->get_thread_cache();
+
+		if (owner == &cache) [[likely]] {
+			chunk->next_chunk = cache.local_chunks;
+			cache.local_chunks = chunk;
+
+			if (++cache.n_local_chunks > (2 * this->batch_size)) [[unlikely]]
+				this->flush(cache);
+		}
+		else
+			owner->push_remote(chunk);
+	}
+
+private:
+	inline ThreadCache& get_thread_cache ()
+	{
+		ThreadCacheSlot& slot = thread_cache_slots[this->pool_id % n_thread_cache_slots];
+
+		if (slot.pool_id == this->pool_id) [[likely]]
+			return *slot.cache;
+
+		return this->bind_thread_cache(slot);
+	}
+
+	ThreadCache& bind_thread_cache (ThreadCacheSlot& slot);
+	void release_thread_cache (ThreadCache& cache);
+	void release_remote_chunks (ThreadCache& cache);
+	void refill (ThreadCache& cache);
+	void flush (ThreadCache& cache);
+};
+
+// ---------------------------------------------------
+
+/*
+	Histogram of the requested type sizes.
+	PoolManager records it when MYLIB_MEMORY_STATS is defined (see PoolManager::get_size_profile),
+	and it can be used to build the size classes of the next run.
+*/
+
+class SizeProfile
+{
 private:
-	Chunk* alloc_new_chunk (size_t payload_size);
-	Chunk* find_free_block (size_t payload_size);
-	Chunk* split_block (Chunk *block, size_t payload_size);
+	std::map<size_t, uint64_t> histogram; // type_size -> number of allocations
 
-	constexpr size_t calculate_required_space (size_t payload_size)
+public:
+	inline void record (const size_t type_size, const uint64_t n = 1)
 	{
-		return payload_size + sizeof(Chunk);
+		this->histogram[type_size] += n;
 	}
 
-	constexpr size_t calculate_payload_size (size_t allocated_capacity)
+	const std::map<size_t, uint64_t>& get_histogram () const noexcept
 	{
-		return allocated_capacity - sizeof(Chunk);
+		return this->histogram;
+	}
+
+	/*
+		Builds the list of at most n_classes size classes that minimizes the memory
+		wasted by rounding the recorded sizes up to their size class
+		(weighted by the number of allocations of each size).
+		Sizes greater than max_type_size are ignored, since they are not handled by the pools.
+		The size classes are multiples of granularity.
+		n_classes must be at least 1.
+	*/
+
+	std::vector<size_t> build_size_classes (const uint32_t n_classes, const size_t max_type_size, const size_t granularity = PoolCore::lowest_chunk_size()) const;
+
+	void dump_histogram (std::ostream& out) const;
+
+	// Writes a SizeClassTable alias with the given size classes,
+	// so they can be compiled in for the next run.
+
+	static void dump_size_class_table (std::ostream& out, const char *name, const std::vector<size_t>& size_classes);
+};
+
+// ---------------------------------------------------
+
+/*
+	Size classes known at compile time.
+	Instead of the vector of max_type_size + 1 pointers that PoolManager
+	builds at runtime, the map from type_size to size class is a constexpr
+	table of 16-bit class numbers, stored in read-only memory.
+
+	The sizes must be in strictly ascending order.
+*/
+
+template <size_t... sizes>
+struct SizeClassTable {
+	static constexpr size_t n_classes = sizeof...(sizes);
+	static constexpr std::array<size_t, n_classes> size_classes = { sizes... };
+	static constexpr size_t max_type_size = size_classes[n_classes - 1];
+
+	static_assert(n_classes > 0);
+	static_assert(size_classes[0] >= PoolCore::lowest_chunk_size());
+	static_assert(n_classes <= std::numeric_limits<uint16_t>::max());
+	static_assert(std::adjacent_find(size_classes.begin(), size_classes.end(), std::greater_equal<size_t>()) == size_classes.end(), "sizes must be in strictly ascending order");
+
+	static constexpr std::array<uint16_t, max_type_size + 1> build_index () noexcept
+	{
+		std::array<uint16_t, max_type_size + 1> index = {};
+		uint16_t c = 0;
+
+		for (size_t type_size = 1; type_size <= max_type_size; type_size++) {
+			if (type_size > size_classes[c])
+				c++;
+			index[type_size] = c;
+		}
+
+		return index;
 	}
+
+	static constexpr std::array<uint16_t, max_type_size + 1> index = build_index();
+};
+
+// ---------------------------------------------------
+
+class PoolManager : public Manager
+{
+private:
+	// Maximum type_size handled by the allocator.
+	// Any size greater than it will be directly forwarded to malloc/free.
+	MYLIB_OO_ENCAPSULATE_SCALAR_READONLY(size_t, max_type_size)
+	
+	std::vector<PoolCore*> allocators;
+
+	// allocators_index[type_size] is the size class of type_size in allocators.
+	// It points either to allocators_index_storage or to the table of a SizeClassTable.
+	std::span<const uint16_t> allocators_index;
+	std::vector<uint16_t> allocators_index_storage;
+
+	size_t trim_cursor = 0; // next size class to be trimmed
+
+	// backend of the blocks of all the pools, the size-less deallocate needs Segments
+	BlockBackend block_backend = BlockBackend::Heap;
+
+	// Manager used for sizes greater than max_type_size (a GeneralManager, for instance).
+	// When nullptr, they are forwarded to malloc/free.
+	MYLIB_OO_ENCAPSULATE_PTR_INIT(Manager*, large_manager, nullptr)
+
+	MYLIB_MEMORY_STATS_RUN( StatsCounters stats_total; )
+	MYLIB_MEMORY_STATS_RUN( StatsCounters stats_fallback; )
+	MYLIB_MEMORY_STATS_RUN( SizeProfile size_profile; )
+
+private:
+	void load (std::vector<SizeClass>& size_classes, const size_t max_block_size, const BlockPolicy& block_policy);
+	void create_allocators (const std::span<const SizeClass> size_classes, const size_t max_block_size, const BlockPolicy& block_policy);
+	void create_allocators (const std::span<const size_t> list_type_sizes, const size_t max_block_size, const BlockPolicy& block_policy);
+
+public:
+	// max_block_size: max amount of memory to be allocated per malloc
+	//                 (for BlockGrowth::Doubling, the size of the first block)
+	PoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+	PoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+
+	// Size classes with their own alignment, for instance {{16, cache_line_size}, {64, 16}}.
+	// The classes created from plain sizes are aligned to the largest
+	// power of two that divides the size (up to __STDCPP_DEFAULT_NEW_ALIGNMENT__),
+	// so they have no padding.
+	PoolManager (const std::span<const SizeClass> size_classes, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+	PoolManager (std::initializer_list<SizeClass> size_classes, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+	PoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+
+	// n_classes size classes built from a recorded profile (see SizeProfile::build_size_classes).
+	// When the largest recorded size is below max_type_size, a last class of max_type_size
+	// is added, so all the sizes up to max_type_size still go to the pools.
+	PoolManager (const SizeProfile& profile, const uint32_t n_classes, const size_t max_type_size, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+
+	// size classes compiled in
+	// (first_size is separate so that a braced list of sizes doesn't deduce an empty table)
+	template <size_t first_size, size_t... sizes>
+	PoolManager (const SizeClassTable<first_size, sizes...>& table, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy())
+	{
+		this->create_allocators(table.size_classes, max_block_size, block_policy);
+		this->allocators_index = table.index;
+	}
+
+	~PoolManager ();
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+//std::cout << "allocating..." << std::endl;
+
+		void *p;
+
+		if (count != 1) [[unlikely]]
+			return this->allocate_multi(type_size, count, align);
+
+		if (type_size <= this->max_type_size) [[likely]] {
+			PoolCore *allocator = this->get_allocator(type_size);
+			p = allocator->allocate();
+			MYLIB_MEMORY_STATS_RUN( this->stats_pool_allocated(allocator, type_size, 1, 1); )
+		}
+		else {
+			if (this->large_manager != nullptr)
+				p = this->large_manager->allocate(type_size, count, align);
+			else
+				p = m_allocate(type_size, align);
+
+			MYLIB_MEMORY_STATS_RUN( this->stats_fallback_allocated(type_size); )
+		}
+
+		return p;
+	}
+
+	/*
+		Size-less deallocation, like free().
+		The pool of the chunk is found in the segment_map,
+		so it requires the pools to use BlockBackend::Segments (asserted).
+		Pointers that don't belong to any pool are forwarded to operator delete,
+		so it only works for the sizes above max_type_size when large_manager
+		is nullptr (asserted) and the alignment is not greater than the default.
+		Runs of chunks (arrays that don't fit in a single chunk) need the sized version.
+		With MYLIB_MEMORY_STATS, the requested size is taken as the chunk size.
+	*/
+
+	void deallocate (void *p)
+	{
+		mylib_assert_msg(this->block_backend == BlockBackend::Segments, "size-less deallocate requires the pools to use BlockBackend::Segments")
+
+		PoolCore *allocator = segment_map.find(p);
+
+		if (allocator != nullptr) [[likely]] {
+			allocator->deallocate(p);
+			MYLIB_MEMORY_STATS_RUN( this->stats_pool_deallocated(allocator, allocator->get_chunk_size(), 1, 1); )
+		}
+		else {
+			mylib_assert_msg(this->large_manager == nullptr, "size-less deallocate of ", p, " can't be forwarded to the large_manager")
+
+			MYLIB_MEMORY_STATS_RUN( this->stats_fallback.n_deallocations++; )
+			MYLIB_MEMORY_STATS_RUN( this->stats_total.n_deallocations++; )
+			::operator delete(p);
+		}
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+//std::cout << "deallocating..." << std::endl;
+
+		if (count != 1) [[unlikely]] {
+			this->deallocate_multi(p, type_size, count, align);
+			return;
+		}
+
+		if (type_size <= this->max_type_size) [[likely]] {
+			PoolCore *allocator = this->get_allocator(type_size);
+			allocator->deallocate(p);
+			MYLIB_MEMORY_STATS_RUN( this->stats_pool_deallocated(allocator, type_size, 1, 1); )
+		}
+		else {
+			if (this->large_manager != nullptr)
+				this->large_manager->deallocate(p, type_size, count, align);
+			else
+				m_deallocate(p, type_size, align);
+
+			MYLIB_MEMORY_STATS_RUN( this->stats_fallback_deallocated(type_size); )
+		}
+	}
+
+	// Incremental trim of all the size classes.
+	// See PoolCore::trim.
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max());
+
+	void shrink_to_fit ()
+	{
+		this->trim();
+	}
+
+	std::span<PoolCore* const> get_pools () const noexcept
+	{
+		return this->allocators;
+	}
+
+	// Pool of the size class of type_size, or nullptr if it is not handled by the pools.
+	PoolCore* get_pool (const size_t type_size) const noexcept
+	{
+		return (type_size <= this->max_type_size) ? this->get_allocator(type_size) : nullptr;
+	}
+
+	// Pre-sizes the size class of type_size for n allocations.
+	void reserve (const size_t type_size, const uint32_t n)
+	{
+		if (type_size <= this->max_type_size)
+			this->get_allocator(type_size)->reserve(n);
+	}
+
+	void allocate_bulk (std::span<void*> ptrs, const size_t type_size, const size_t align) override final
+	{
+		if (type_size <= this->max_type_size) [[likely]] {
+			PoolCore *allocator = this->get_allocator(type_size);
+			allocator->allocate_bulk(ptrs);
+			MYLIB_MEMORY_STATS_RUN( this->stats_pool_allocated(allocator, type_size, 1, ptrs.size()); )
+		}
+		else
+			this->Manager::allocate_bulk(ptrs, type_size, align);
+	}
+
+	void deallocate_bulk (std::span<void*> ptrs, const size_t type_size, const size_t align) override final
+	{
+		if (type_size <= this->max_type_size) [[likely]] {
+			PoolCore *allocator = this->get_allocator(type_size);
+			allocator->deallocate_bulk(ptrs);
+			MYLIB_MEMORY_STATS_RUN( this->stats_pool_deallocated(allocator, type_size, 1, ptrs.size()); )
+		}
+		else
+			this->Manager::deallocate_bulk(ptrs, type_size, align);
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	Stats get_stats () const override final;
+
+	const SizeProfile& get_size_profile () const noexcept
+	{
+		return this->size_profile;
+	}
+#endif
+
+private:
+	inline PoolCore* get_allocator (const size_t type_size) const noexcept
+	{
+		return this->allocators[ this->allocators_index[type_size] ];
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	// The pools count in chunks of their own size,
+	// so we fix their requested bytes with the size the user asked for.
+
+	inline void stats_pool_allocated (PoolCore *allocator, const size_t requested_bytes, const uint32_t n_chunks, const uint64_t n_allocations) noexcept
+	{
+		const size_t bytes = allocator->get_chunk_size() * n_chunks;
+		this->stats_total.allocated(bytes * n_allocations, n_allocations);
+		this->size_profile.record(requested_bytes, n_allocations);
+		allocator->stats_add_requested((requested_bytes - bytes) * n_allocations);
+	}
+
+	inline void stats_pool_deallocated (PoolCore *allocator, const size_t requested_bytes, const uint32_t n_chunks, const uint64_t n_allocations) noexcept
+	{
+		const size_t bytes = allocator->get_chunk_size() * n_chunks;
+		this->stats_total.deallocated(bytes * n_allocations, n_allocations);
+		allocator->stats_add_requested((bytes - requested_bytes) * n_allocations);
+	}
+
+	inline void stats_fallback_allocated (const size_t bytes) noexcept
+	{
+		this->stats_total.allocated(bytes);
+		this->size_profile.record(bytes);
+		this->stats_fallback.allocated(bytes);
+	}
+
+	inline void stats_fallback_deallocated (const size_t bytes) noexcept
+	{
+		this->stats_total.deallocated(bytes);
+		this->stats_fallback.deallocated(bytes);
+	}
+#endif
+
+
+	void* allocate_multi (const size_t type_size, const size_t count, const size_t align);
+	void deallocate_multi (void *p, const size_t type_size, const size_t count, const size_t align);
+	PoolCore* find_contiguous_allocator (const size_t type_size, const size_t count, uint32_t& n_chunks);
+};
+
+// ---------------------------------------------------
+
+/*
+	One PoolManager per NUMA node, with the blocks bound to the node.
+	Allocations are served by the manager of the node the calling thread is running on.
+	Memory freed by a thread of another node goes back to the manager that owns it,
+	found through the segment_map (the pools use BlockBackend::Segments).
+
+	Each node manager has its own mutex, so threads of different nodes
+	don't contend with each other.
+	On systems without NUMA, there is a single node.
+*/
+
+class NumaPoolManager : public Manager
+{
+private:
+	struct Node {
+		std::unique_ptr<PoolManager> manager;
+		std::mutex mutex;
+	};
+
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::unordered_map<const PoolCore*, uint32_t> pool_nodes;
+
+public:
+	NumaPoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy());
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		Node& node = *this->nodes[ this->get_current_node() ];
+		std::scoped_lock lock(node.mutex);
+		return node.manager->allocate(type_size, count, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		Node& node = *this->nodes[ this->find_node(p) ];
+		std::scoped_lock lock(node.mutex);
+		node.manager->deallocate(p, type_size, count, align);
+	}
+
+	uint32_t get_n_nodes () const noexcept
+	{
+		return this->nodes.size();
+	}
+
+	PoolManager& get_node_manager (const uint32_t node) noexcept
+	{
+		return *this->nodes[node]->manager;
+	}
+
+	// Node whose manager owns p.
+	// Memory that is not in the pools (large sizes) belongs to no node,
+	// since the fallback is the same for all of them, so we return node 0.
+	uint32_t find_node (const void *p) const
+	{
+		const PoolCore *pool = segment_map.find(p);
+
+		if (pool == nullptr)
+			return 0;
+
+		auto it = this->pool_nodes.find(pool);
+
+		return (it != this->pool_nodes.end()) ? it->second : 0;
+	}
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max());
+
+private:
+	uint32_t get_current_node () const
+	{
+		const uint32_t node = get_numa_current_node();
+		return (node < this->nodes.size()) ? node : 0;
+	}
+};
+
+// ---------------------------------------------------
+
+template <size_t chunk_size>
+struct StaticPoolManagerSlot {
+	PoolCore pool;
+
+	StaticPoolManagerSlot (const size_t max_block_size, const BlockPolicy& block_policy)
+		: pool(chunk_size, max_block_size / chunk_size, __STDCPP_DEFAULT_NEW_ALIGNMENT__, block_policy)
+	{
+	}
+};
+
+/*
+	PoolManager with the size classes known at compile time.
+
+	The pools live inside the manager (one base class per size class),
+	so when the type is known at compile time (allocate_type<T>, allocate_static<size>),
+	the pool is picked at compile time and there is no virtual call
+	nor any lookup table involved.
+	Notice that these functions hide the ones of Manager,
+	so the static path is only taken when the StaticPoolManager type is known.
+
+	Type-erased callers (AllocatorSTL, for instance) use the runtime
+	Manager interface, which works just like PoolManager.
+*/
+
+template <size_t... sizes>
+class StaticPoolManager : public Manager, private StaticPoolManagerSlot<sizes>...
+{
+public:
+	using Table = SizeClassTable<sizes...>;
+
+	static constexpr size_t max_type_size = Table::max_type_size;
+
+private:
+	std::array<PoolCore*, Table::n_classes> pools; // for the runtime interface
+
+	MYLIB_MEMORY_STATS_RUN( StatsCounters stats_fallback; )
+
+public:
+	StaticPoolManager (const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy())
+		: StaticPoolManagerSlot<sizes>(max_block_size, block_policy)...,
+		  pools { &this->StaticPoolManagerSlot<sizes>::pool... }
+	{
+	}
+
+	MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(StaticPoolManager)
+
+	template <size_t type_size>
+	PoolCore& get_pool () noexcept
+	{
+		static_assert(type_size <= max_type_size);
+		constexpr size_t chunk_size = Table::size_classes[ Table::index[type_size] ];
+		return this->StaticPoolManagerSlot<chunk_size>::pool;
+	}
+
+	// compile-time dispatch
+
+	template <size_t type_size, size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__>
+	[[nodiscard]] inline void* allocate_static ()
+	{
+		if constexpr (type_size <= max_type_size && align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+			PoolCore& pool = this->get_pool<type_size>();
+			MYLIB_MEMORY_STATS_RUN( pool.stats_add_requested(type_size - pool.get_chunk_size()); )
+			return pool.allocate();
+		}
+		else {
+			MYLIB_MEMORY_STATS_RUN( this->stats_fallback.allocated(type_size); )
+			return m_allocate(type_size, align);
+		}
+	}
+
+	template <size_t type_size, size_t align = __STDCPP_DEFAULT_NEW_ALIGNMENT__>
+	inline void deallocate_static (void *p)
+	{
+		if constexpr (type_size <= max_type_size && align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+			PoolCore& pool = this->get_pool<type_size>();
+			MYLIB_MEMORY_STATS_RUN( pool.stats_add_requested(pool.get_chunk_size() - type_size); )
+			pool.deallocate(p);
+		}
+		else {
+			MYLIB_MEMORY_STATS_RUN( this->stats_fallback.deallocated(type_size); )
+			m_deallocate(p, type_size, align);
+		}
+	}
+
+	template <typename T>
+	[[nodiscard]] inline T* allocate_type (const size_t count = 1)
+	{
+		if (count == 1) [[likely]]
+			return static_cast<T*>( this->allocate_static<calculate_size<T>(), calculate_alignment<T>()>() );
+		else
+			return static_cast<T*>( this->allocate(calculate_size<T>(), count, calculate_alignment<T>()) );
+	}
+
+	template <typename T>
+	inline void deallocate_type (T *p, const size_t count = 1)
+	{
+		if (count == 1) [[likely]]
+			this->deallocate_static<calculate_size<T>(), calculate_alignment<T>()>(p);
+		else
+			this->deallocate(p, calculate_size<T>(), count, calculate_alignment<T>());
+	}
+
+	template <typename T>
+	void destruct_deallocate_type (T *p)
+	{
+		p->~T();
+		this->deallocate_type<T>(p);
+	}
+
+	template <typename T, typename... Types>
+	[[nodiscard]] T* allocate_construct_type (Types&&... vars)
+	{
+		T *ptr = new (this->allocate_type<T>()) T(std::forward<Types>(vars)...);
+		return ptr;
+	}
+
+	// runtime dispatch
+	// Arrays that fit in a single chunk are served by the pools.
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		const size_t size = type_size * count;
+
+		if (size <= max_type_size && align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) [[likely]] {
+			PoolCore *pool = this->pools[ Table::index[size] ];
+			MYLIB_MEMORY_STATS_RUN( pool->stats_add_requested(size - pool->get_chunk_size()); )
+			return pool->allocate();
+		}
+
+		MYLIB_MEMORY_STATS_RUN( this->stats_fallback.allocated(size); )
+
+		return m_allocate(size, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		const size_t size = type_size * count;
+
+		if (size <= max_type_size && align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) [[likely]] {
+			PoolCore *pool = this->pools[ Table::index[size] ];
+			MYLIB_MEMORY_STATS_RUN( pool->stats_add_requested(pool->get_chunk_size() - size); )
+			pool->deallocate(p);
+			return;
+		}
+
+		MYLIB_MEMORY_STATS_RUN( this->stats_fallback.deallocated(size); )
+
+		m_deallocate(p, size, align);
+	}
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max())
+	{
+		size_t n = 0;
+
+		for (PoolCore *pool : this->pools)
+			n += pool->trim(max_chunks - n);
+
+		return n;
+	}
+
+	void shrink_to_fit ()
+	{
+		this->trim();
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	// The total peak is the sum of the peaks of each size class,
+	// since we don't keep a global counter for the static path.
+
+	Stats get_stats () const override final
+	{
+		Stats s;
+
+		s.total = this->stats_fallback;
+		s.fallback = this->stats_fallback;
+		s.requested_bytes = this->stats_fallback.current_bytes;
+
+		for (const PoolCore *pool : this->pools) {
+			SizeClassStats c = pool->get_size_class_stats();
+
+			s.total.n_allocations += c.counters.n_allocations;
+			s.total.n_deallocations += c.counters.n_deallocations;
+			s.total.current_bytes += c.counters.current_bytes;
+			s.total.peak_bytes += c.counters.peak_bytes;
+			s.requested_bytes += c.requested_bytes;
+			s.n_allocated_blocks += c.n_allocated_blocks;
+			s.block_bytes += c.block_bytes;
+			s.size_classes.push_back(c);
+		}
+
+		return s;
+	}
+#endif
+};
+
+// ---------------------------------------------------
+
+/*
+	Same as PoolManager, but using ConcurrentPoolCore for the size classes,
+	so it can be shared by multiple threads.
+*/
+
+class ConcurrentPoolManager : public Manager
+{
+private:
+	size_t max_type_size;
+	
+	std::vector<ConcurrentPoolCore*> allocators;
+	std::vector<ConcurrentPoolCore*> allocators_index;
+
+	void load (std::vector<size_t>& list_type_sizes, const size_t max_block_size);
+
+public:
+	ConcurrentPoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size = default_block_size);
+	ConcurrentPoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size = default_block_size);
+	ConcurrentPoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size = default_block_size);
+
+	~ConcurrentPoolManager ();
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		mylib_assert_exception_args(count == 1, PoolAllocatorMultiException, type_size, count, align);
+
+		if (type_size <= this->max_type_size) [[likely]]
+			return this->allocators_index[type_size]->allocate();
+		else
+			return m_allocate(type_size, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		mylib_assert_exception_args(count == 1, PoolAllocatorMultiException, type_size, count, align);
+
+		if (type_size <= this->max_type_size) [[likely]]
+			this->allocators_index[type_size]->deallocate(p);
+		else
+			m_deallocate(p, type_size, align);
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	General purpose allocator, for any size.
+	Used mainly for sizes that are too large for the pools.
+
+	This class handle chunks differently from PoolCore.
+	In PoolCore, the pre-allocated chunks:
+		- when a chunk is free, it stores a linked list of free chunks;
+		- when a chunk is occupied, it is 100% used (except when
+		  element size < sizeof(void*)) to store the payload.
+	Therefore, when a chunk is occupied, no memory is "wasted".
+	The chunk and payload occupies the same address.
+
+	However, this class can't work like that, because we keep
+	a permanent double-linked list of the chunks of each block (left and right).
+	The reason is that we want to merge consecutive free chunks into one
+	when a deallocation is performed, in order to reduce fragmentation.
+	Therefore, each chunk first contains its metadata (Chunk), followed by the payload.
+
+	Free chunks are stored in segregated free lists, one list per size class.
+	Size classes are organized in two levels (like TLSF):
+		- first level: power of two of the size;
+		- second level: each power of two range is split in n_second_level classes.
+	A bitmap for each level allows us to find a free chunk large enough in O(1).
+
+	Requests with alignment greater than the default are forwarded to m_allocate.
+*/
+
+class GeneralManager : public Manager
+{
+private:
+	enum class ChunkStatus : uint8_t {
+		Free,
+		Occupied
+	};
+
+	struct MYLIB_ALIGN_STRUCT(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Chunk {
+		Chunk *left;  // physical neighbours in the block
+		Chunk *right;
+		Chunk *previous_free_chunk;
+		Chunk *next_free_chunk;
+		size_t payload_capacity;
+		ChunkStatus status;
+	};
+
+	struct MYLIB_ALIGN_STRUCT(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Block {
+		Block *previous_block;
+		Block *next_block;
+		size_t size;
+	};
+
+	static constexpr size_t alignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+	static constexpr size_t min_payload = alignment;
+
+	static constexpr uint32_t second_level_log2 = 4;
+	static constexpr uint32_t n_second_level = 1 << second_level_log2;
+	static constexpr uint32_t first_level_shift = second_level_log2 + std::countr_zero(alignment);
+	static constexpr size_t small_size = static_cast<size_t>(1) << first_level_shift;
+	static constexpr uint32_t first_level_max = 48; // 256 TB
+	static constexpr uint32_t n_first_level = first_level_max - first_level_shift + 1;
+
+	static_assert(sizeof(Chunk) % alignment == 0);
+	static_assert(sizeof(Block) % alignment == 0);
+
+	Block *blocks = nullptr;
+
+	uint64_t first_level_bitmap = 0;
+	uint32_t second_level_bitmap[n_first_level] = {};
+	Chunk *free_chunks[n_first_level][n_second_level] = {};
+
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, target_block_size)
+
+public:
+	GeneralManager (const size_t target_block_size_ = 128 * 1024);
+	~GeneralManager ();
+
+	MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(GeneralManager)
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		if (align > alignment) [[unlikely]]
+			return m_allocate(type_size * count, align);
+
+		return this->allocate_chunk(type_size * count);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		if (align > alignment) [[unlikely]]
+			m_deallocate(p, type_size * count, align);
+		else
+			this->deallocate_chunk(p);
+	}
+
+	[[nodiscard]] void* allocate_chunk (const size_t size);
+	void deallocate_chunk (void *p);
+
+private:
+	Chunk* alloc_new_block (const size_t payload_size);
+	void release_block (Block *block);
+	Chunk* find_free_chunk (const size_t payload_size);
+	void split_chunk (Chunk *chunk, const size_t payload_size);
+	void insert_free_chunk (Chunk *chunk);
+	void remove_free_chunk (Chunk *chunk);
+
+	static constexpr size_t calculate_required_space (const size_t payload_size) noexcept
+	{
+		return payload_size + sizeof(Chunk);
+	}
+
+	static constexpr size_t calculate_payload_size (const size_t allocated_capacity) noexcept
+	{
+		return allocated_capacity - sizeof(Chunk);
+	}
+
+	static constexpr void mapping_insert (const size_t size, uint32_t& first_level, uint32_t& second_level) noexcept
+	{
+		if (size < small_size) {
+			first_level = 0;
+			second_level = static_cast<uint32_t>(size / (small_size / n_second_level));
+		}
+		else {
+			const uint32_t log2 = std::bit_width(size) - 1;
+			second_level = static_cast<uint32_t>(size >> (log2 - second_level_log2)) ^ n_second_level;
+			first_level = log2 - (first_level_shift - 1);
+		}
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Debug checks for the pools.
+
+	A bug that corrupts the free list of a pool usually only crashes
+	much later, far from where it happened.
+	CheckedPoolCore and CheckedPoolManager wrap a PoolCore and a PoolManager
+	and check each allocation and deallocation, so we find the bug where it is.
+	A failed check throws an AssertException.
+
+	The checks are selected by a policy type (PoolNoChecks, PoolDebugChecks,
+	or any struct with the same constants).
+	With PoolNoChecks, the wrappers compile down to the wrapped calls.
+*/
+
+struct PoolNoChecks {
+	static constexpr bool poison = false;      // freed chunks are filled with a pattern, verified when they are allocated again (use after free)
+	static constexpr bool canaries = false;    // guard words before and after each chunk, verified when it is freed (overflows)
+	static constexpr bool double_free = false; // shadow bitmap of the allocated chunks (double frees, invalid pointers, corrupted free list)
+	static constexpr bool cross_pool = false;  // the chunk must be freed to the pool it came from
+	static constexpr bool annotate = false;    // free chunks are marked as inaccessible for ASan and Valgrind
+};
+
+struct PoolDebugChecks {
+	static constexpr bool poison = true;
+	static constexpr bool canaries = true;
+	static constexpr bool double_free = true;
+	static constexpr bool cross_pool = true;
+	static constexpr bool annotate = true;
+};
+
+// ---------------------------------------------------
+
+/*
+	Layout of a checked chunk:
+
+	| front canary | object | rear canary |
+
+	The front canary takes a whole alignment unit, so the object keeps its alignment.
+	While the chunk is free, the pool stores the free list pointer in it,
+	so it is also the part of the chunk that is never poisoned.
+
+	The shadow bitmaps and the owner of a chunk come from the segment_map,
+	so the pools are forced to BlockBackend::Segments when they are needed.
+*/
+
+template <typename Tchecks>
+class PoolChecker
+{
+public:
+	static constexpr uint8_t poison_byte = 0xDD;
+	static constexpr uint64_t canary = 0xC0DEDBADC0DEDBAD;
+
+	static constexpr bool needs_shadow = Tchecks::poison || Tchecks::double_free;
+	static constexpr bool needs_segments = needs_shadow || Tchecks::cross_pool;
+
+private:
+	// One bit per lowest_chunk_size bytes of the segment, enough to tell its chunks apart.
+	static constexpr size_t n_shadow_bits = segment_size / PoolCore::lowest_chunk_size();
+
+	struct Shadow {
+		const PoolCore *owner;
+		std::bitset<n_shadow_bits> allocated;
+		std::bitset<n_shadow_bits> poisoned; // freed at least once, so it holds the poison pattern
+	};
+
+	using Shadows = std::unordered_map<uintptr_t, Shadow>; // by segment address
+
+	[[no_unique_address]] std::conditional_t<needs_shadow, Shadows, EmptyStruct> shadows;
+
+public:
+	static constexpr size_t front_size (const size_t align) noexcept
+	{
+		if constexpr (Tchecks::canaries)
+			return (align > sizeof(uint64_t)) ? align : sizeof(uint64_t);
+		else
+			return 0;
+	}
+
+	static constexpr size_t body_size (const size_t type_size) noexcept
+	{
+		if constexpr (Tchecks::canaries)
+			return ((type_size + sizeof(uint64_t) - 1) / sizeof(uint64_t)) * sizeof(uint64_t);
+		else
+			return type_size;
+	}
+
+	// size of the chunk that holds an object of type_size
+	static constexpr size_t chunk_size (const size_t type_size, const size_t align) noexcept
+	{
+		return front_size(align) + body_size(type_size) + (Tchecks::canaries ? sizeof(uint64_t) : 0);
+	}
+
+	static constexpr BlockPolicy block_policy (BlockPolicy policy) noexcept
+	{
+		if constexpr (needs_segments)
+			policy.backend = BlockBackend::Segments;
+
+		return policy;
+	}
+
+	// Receives a chunk that the pool has just allocated, and returns the pointer to the object.
+
+	void* on_allocate (void *chunk, const size_t type_size, const size_t align)
+	{
+		uint8_t *c = static_cast<uint8_t*>(chunk);
+		const size_t size = chunk_size(type_size, align);
+
+		if constexpr (Tchecks::annotate)
+			annotate_access(c, size);
+
+		if constexpr (needs_shadow) {
+			auto [shadow, i] = this->get_shadow(c);
+
+			if constexpr (Tchecks::poison) {
+				if (shadow.poisoned[i]) {
+					for (size_t j = sizeof(void*); j < size; j++)
+						mylib_assert_msg(c[j] == poison_byte, "chunk ", chunk, " was modified after being freed (offset ", j, ")")
+				}
+			}
+
+			if constexpr (Tchecks::double_free)
+				mylib_assert_msg(!shadow.allocated[i], "chunk ", chunk, " allocated twice, the free list is corrupted")
+
+			shadow.allocated[i] = true;
+		}
+
+		if constexpr (Tchecks::canaries) {
+			std::memcpy(c, &canary, sizeof(uint64_t));
+			std::memcpy(c + front_size(align) + body_size(type_size), &canary, sizeof(uint64_t));
+		}
+
+		return c + front_size(align);
+	}
+
+	// Receives a pointer to the object, and returns the chunk to be freed to pool.
+
+	void* on_deallocate (void *p, const PoolCore *pool, const size_t type_size, const size_t align)
+	{
+		uint8_t *c = static_cast<uint8_t*>(p) - front_size(align);
+		const size_t size = chunk_size(type_size, align);
+
+		if constexpr (Tchecks::cross_pool)
+			mylib_assert_msg(segment_map.find(c) == pool, "pointer ", p, " freed to a pool it doesn't belong to")
+
+		if constexpr (needs_shadow) {
+			auto [shadow, i] = this->get_shadow(c);
+
+			if constexpr (Tchecks::double_free)
+				mylib_assert_msg(shadow.allocated[i], "double free or invalid pointer ", p)
+
+			shadow.allocated[i] = false;
+			shadow.poisoned[i] = Tchecks::poison;
+		}
+
+		if constexpr (Tchecks::canaries) {
+			uint64_t front, rear;
+			std::memcpy(&front, c, sizeof(uint64_t));
+			std::memcpy(&rear, c + front_size(align) + body_size(type_size), sizeof(uint64_t));
+			mylib_assert_msg(front == canary, "buffer underflow in ", p)
+			mylib_assert_msg(rear == canary, "buffer overflow in ", p)
+		}
+
+		if constexpr (Tchecks::poison)
+			std::memset(c, poison_byte, size);
+
+		// the pool writes the free list pointer at the beginning of the chunk
+		if constexpr (Tchecks::annotate) {
+			if (size > sizeof(void*))
+				annotate_no_access(c + sizeof(void*), size - sizeof(void*));
+		}
+
+		return c;
+	}
+
+	// Blocks released by trim may come back later for another pool,
+	// or for the same pool with fresh memory, so we forget them.
+
+	void forget_released_segments ()
+	{
+		if constexpr (needs_shadow) {
+			std::erase_if(this->shadows, [] (const auto& pair) -> bool {
+				return (segment_map.find(reinterpret_cast<const void*>(pair.first)) != pair.second.owner);
+			});
+		}
+	}
+
+private:
+	std::pair<Shadow&, size_t> get_shadow (const void *chunk)
+		requires needs_shadow
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(chunk);
+		const uintptr_t segment = address & ~static_cast<uintptr_t>(segment_size - 1);
+		const PoolCore *owner = segment_map.find(chunk);
+
+		mylib_assert_msg(owner != nullptr, "pointer ", chunk, " doesn't belong to any pool")
+
+		Shadow& shadow = this->shadows[segment];
+
+		if (shadow.owner != owner) {
+			shadow.owner = owner;
+			shadow.allocated.reset();
+			shadow.poisoned.reset();
+		}
+
+		return { shadow, (address - segment) / PoolCore::lowest_chunk_size() };
+	}
+
+	static void annotate_access (void *p, const size_t size) noexcept
+	{
+	#if defined(MYLIB_MEMORY_ASAN)
+		ASAN_UNPOISON_MEMORY_REGION(p, size);
+	#endif
+	#if defined(MYLIB_MEMORY_VALGRIND)
+		VALGRIND_MAKE_MEM_DEFINED(p, size);
+	#endif
+		(void)p; (void)size;
+	}
+
+	static void annotate_no_access (void *p, const size_t size) noexcept
+	{
+	#if defined(MYLIB_MEMORY_ASAN)
+		ASAN_POISON_MEMORY_REGION(p, size);
+	#endif
+	#if defined(MYLIB_MEMORY_VALGRIND)
+		VALGRIND_MAKE_MEM_NOACCESS(p, size);
+	#endif
+		(void)p; (void)size;
+	}
+};
+
+// ---------------------------------------------------
+
+template <typename Tchecks = PoolDebugChecks>
+class CheckedPoolCore
+{
+private:
+	using Checker = PoolChecker<Tchecks>;
+
+	PoolCore core;
+	Checker checker;
+
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, type_size)
+	MYLIB_OO_ENCAPSULATE_SCALAR_CONST_READONLY(size_t, align)
+
+public:
+	CheckedPoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_, const BlockPolicy& block_policy_ = BlockPolicy())
+		: core(Checker::chunk_size(type_size_, align_), chunks_per_block_, align_, Checker::block_policy(block_policy_)),
+		  type_size(type_size_), align(align_)
+	{
+	}
+
+	[[nodiscard]] inline void* allocate ()
+	{
+		return this->checker.on_allocate(this->core.allocate(), this->type_size, this->align);
+	}
+
+	inline void deallocate (void *p)
+	{
+		this->core.deallocate( this->checker.on_deallocate(p, &this->core, this->type_size, this->align) );
+	}
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max())
+	{
+		const size_t n = this->core.trim(max_chunks);
+		this->checker.forget_released_segments();
+		return n;
+	}
+
+	void shrink_to_fit ()
+	{
+		this->trim();
+	}
+
+	PoolCore& get_core () noexcept
+	{
+		return this->core;
+	}
+};
+
+// ---------------------------------------------------
+
+/*
+	Arrays are checked as a single object of type_size * count.
+	The sizes above max_type_size don't go to the pools, so they are forwarded unchecked.
+*/
+
+template <typename Tchecks = PoolDebugChecks>
+class CheckedPoolManager : public Manager
+{
+private:
+	using Checker = PoolChecker<Tchecks>;
+
+	PoolManager manager;
+	Checker checker;
+
+public:
+	// type sizes are the sizes of the objects, the chunks are increased to fit the checks
+	CheckedPoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size = default_block_size, const BlockPolicy& block_policy = BlockPolicy())
+		: manager(Checker::chunk_size(max_type_size, __STDCPP_DEFAULT_NEW_ALIGNMENT__), step_size, max_block_size, Checker::block_policy(block_policy))
+	{
+	}
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		if (!this->is_checked(type_size, count, align)) [[unlikely]]
+			return this->manager.allocate(type_size, count, align);
+
+		const size_t size = Checker::chunk_size(type_size * count, align);
+
+		return this->checker.on_allocate(this->manager.allocate(size, 1, align), type_size * count, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		if (!this->is_checked(type_size, count, align)) [[unlikely]] {
+			this->manager.deallocate(p, type_size, count, align);
+			return;
+		}
+
+		const size_t size = Checker::chunk_size(type_size * count, align);
+
+		this->manager.deallocate(this->checker.on_deallocate(p, this->manager.get_pool(size), type_size * count, align), size, 1, align);
+	}
+
+	size_t trim (const size_t max_chunks = std::numeric_limits<size_t>::max())
+	{
+		const size_t n = this->manager.trim(max_chunks);
+		this->checker.forget_released_segments();
+		return n;
+	}
+
+	void shrink_to_fit ()
+	{
+		this->trim();
+	}
+
+	PoolManager& get_manager () noexcept
+	{
+		return this->manager;
+	}
+
+private:
+	bool is_checked (const size_t type_size, const size_t count, const size_t align) const noexcept
+	{
+		const size_t max_type_size = this->manager.get_max_type_size();
+
+		return (count <= max_type_size / type_size) && (Checker::chunk_size(type_size * count, align) <= max_type_size);
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	Stats get_stats () const override final
+	{
+		return this->manager.get_stats();
+	}
+#endif
 };
-#endif
 
 // ---------------------------------------------------
 
@@ -5,6 +5,10 @@
 #include <initializer_list>
 #include <vector>
 #include <memory>
+#include <memory_resource>
+#include <span>
+#include <algorithm>
+#include <limits>
 
 #include <cstdint>
 #include <cstdlib>
@@ -79,6 +83,149 @@ consteval size_t calculate_alignment () noexcept
 
 // ---------------------------------------------------
 
+/*
+	Allocator statistics.
+
+	The counters are only compiled in when MYLIB_MEMORY_STATS is defined.
+	Otherwise, they don't exist at all and get_stats is not available.
+	MYLIB_MEMORY_STATS must be defined (or not) equally in all translation units.
+
+	Like the allocators themselves, the counters are not thread-safe.
+*/
+
+#ifdef MYLIB_MEMORY_STATS
+	#define MYLIB_MEMORY_STATS_RUN(...) __VA_ARGS__
+#else
+	#define MYLIB_MEMORY_STATS_RUN(...)
+#endif
+
+struct StatsCounters {
+	uint64_t n_allocations = 0;
+	uint64_t n_deallocations = 0;
+	size_t current_bytes = 0;
+	size_t peak_bytes = 0;
+
+	inline void allocated (const size_t bytes, const uint64_t n = 1) noexcept
+	{
+		this->n_allocations += n;
+		this->current_bytes += bytes;
+
+		if (this->current_bytes > this->peak_bytes)
+			this->peak_bytes = this->current_bytes;
+	}
+
+	inline void deallocated (const size_t bytes, const uint64_t n = 1) noexcept
+	{
+		this->n_deallocations += n;
+		this->current_bytes -= bytes;
+	}
+
+	void dump_json (std::ostream& out) const
+	{
+		out << "{\"allocations\": " << this->n_allocations
+			<< ", \"deallocations\": " << this->n_deallocations
+			<< ", \"current_bytes\": " << this->current_bytes
+			<< ", \"peak_bytes\": " << this->peak_bytes << "}";
+	}
+};
+
+// Stats of one size class (one PoolCore).
+// Bytes are counted in chunks, while requested_bytes is what the user asked for.
+
+struct SizeClassStats {
+	size_t chunk_size = 0;
+	StatsCounters counters;
+	uint64_t n_allocated_blocks = 0; // since the beginning, including released blocks
+	uint32_t n_blocks = 0;           // current
+	size_t block_bytes = 0;          // current
+	size_t requested_bytes = 0;      // current
+
+	// memory wasted by rounding the requested size up to the chunk size
+	size_t internal_fragmentation () const noexcept
+	{
+		return this->counters.current_bytes - this->requested_bytes;
+	}
+};
+
+struct Stats {
+	StatsCounters total;
+	StatsCounters fallback;      // requests forwarded to malloc (or another Manager) by the pools
+	size_t requested_bytes = 0;  // current
+	uint64_t n_allocated_blocks = 0;
+	size_t block_bytes = 0;
+	std::vector<SizeClassStats> size_classes;
+
+	size_t internal_fragmentation () const noexcept
+	{
+		size_t bytes = 0;
+
+		for (const SizeClassStats& c : this->size_classes)
+			bytes += c.internal_fragmentation();
+
+		return bytes;
+	}
+
+	void dump_text (std::ostream& out) const
+	{
+		out << "allocations " << this->total.n_allocations
+			<< " deallocations " << this->total.n_deallocations
+			<< " current " << this->total.current_bytes << "B"
+			<< " peak " << this->total.peak_bytes << "B"
+			<< " requested " << this->requested_bytes << "B"
+			<< " internal fragmentation " << this->internal_fragmentation() << "B" << std::endl;
+
+		out << "blocks allocated " << this->n_allocated_blocks
+			<< " block memory " << this->block_bytes << "B" << std::endl;
+
+		out << "fallback allocations " << this->fallback.n_allocations
+			<< " current " << this->fallback.current_bytes << "B"
+			<< " peak " << this->fallback.peak_bytes << "B" << std::endl;
+
+		for (const SizeClassStats& c : this->size_classes) {
+			out << "\tsize " << c.chunk_size
+				<< " allocations " << c.counters.n_allocations
+				<< " deallocations " << c.counters.n_deallocations
+				<< " current " << c.counters.current_bytes << "B"
+				<< " peak " << c.counters.peak_bytes << "B"
+				<< " internal fragmentation " << c.internal_fragmentation() << "B"
+				<< " blocks " << c.n_blocks << "/" << c.n_allocated_blocks
+				<< " block memory " << c.block_bytes << "B" << std::endl;
+		}
+	}
+
+	void dump_json (std::ostream& out) const
+	{
+		out << "{\"total\": ";
+		this->total.dump_json(out);
+		out << ", \"fallback\": ";
+		this->fallback.dump_json(out);
+		out << ", \"requested_bytes\": " << this->requested_bytes
+			<< ", \"internal_fragmentation_bytes\": " << this->internal_fragmentation()
+			<< ", \"allocated_blocks\": " << this->n_allocated_blocks
+			<< ", \"block_bytes\": " << this->block_bytes
+			<< ", \"size_classes\": [";
+
+		for (size_t i = 0; i < this->size_classes.size(); i++) {
+			const SizeClassStats& c = this->size_classes[i];
+
+			if (i > 0)
+				out << ", ";
+
+			out << "{\"chunk_size\": " << c.chunk_size << ", \"counters\": ";
+			c.counters.dump_json(out);
+			out << ", \"requested_bytes\": " << c.requested_bytes
+				<< ", \"internal_fragmentation_bytes\": " << c.internal_fragmentation()
+				<< ", \"allocated_blocks\": " << c.n_allocated_blocks
+				<< ", \"blocks\": " << c.n_blocks
+				<< ", \"block_bytes\": " << c.block_bytes << "}";
+		}
+
+		out << "]}";
+	}
+};
+
+// ---------------------------------------------------
+
 class Manager
 {
 public:
@@ -95,6 +242,29 @@ public:
 		this->deallocate(p, type_size, count, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
 	}
 
+	// Allocates/deallocates ptrs.size() elements of type_size, one element per pointer.
+	// The default implementation just calls allocate/deallocate for each element.
+	// Managers that can do better (like PoolManager) override them.
+
+	virtual void allocate_bulk (std::span<void*> ptrs, const size_t type_size, const size_t align)
+	{
+		for (void*& p : ptrs)
+			p = this->allocate(type_size, 1, align);
+	}
+
+	virtual void deallocate_bulk (std::span<void*> ptrs, const size_t type_size, const size_t align)
+	{
+		for (void *p : ptrs)
+			this->deallocate(p, type_size, 1, align);
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	virtual Stats get_stats () const
+	{
+		return Stats();
+	}
+#endif
+
 	template <typename T>
 	[[nodiscard]] T* allocate_type (const size_t count)
 	{
@@ -124,15 +294,36 @@ public:
 
 // ---------------------------------------------------
 
+/*
+	Anything with the allocate/deallocate interface of Manager.
+	Used by AllocatorSTL and unique_ptr to hold the concrete manager type.
+*/
+
+template <typename T>
+concept ManagerType = requires (T& manager, void *p, const size_t size) {
+	{ manager.allocate(size, size, size) } -> std::same_as<void*>;
+	manager.deallocate(p, size, size, size);
+};
+
+static_assert(ManagerType<Manager>);
+
+// ---------------------------------------------------
+
 /*
 	Custom STL allocator interface for Memory::Manager.
 	Based on GCC Standard C++ Library.
 	<include>/c++/11/ext/new_allocator.h
 
-	Requires that the number of elements to be allocated at a time is 1.
+	Containers that allocate more than one element at a time (like std::vector)
+	require a Manager that supports count > 1 (PoolManager does).
+
+	By default, the manager is type-erased (Manager), so the calls are virtual.
+	When TManager is the concrete type (AllocatorSTL<T, PoolManager>, for instance),
+	the calls are bound at compile time (the overrides are final) and can be inlined.
+	Keep the type-erased version at ABI boundaries.
 */
 
-template <typename T>
+template <typename T, ManagerType TManager = Manager>
 class AllocatorSTL
 {
 public:
@@ -141,11 +332,11 @@ public:
 	using difference_type = std::ptrdiff_t;
 	using propagate_on_container_move_assignment = std::true_type;
 
-	Manager *manager;
+	TManager *manager;
 
 	AllocatorSTL () = delete;
 
-	AllocatorSTL (Manager& manager_)
+	AllocatorSTL (TManager& manager_)
 		: manager(&manager_)
 	{
 	}
@@ -156,7 +347,7 @@ public:
 	}
 
 	template <typename Tother>
-	AllocatorSTL (const AllocatorSTL<Tother>& other)
+	AllocatorSTL (const AllocatorSTL<Tother, TManager>& other)
 		: manager(other.manager)
 	{
 	}
@@ -167,23 +358,25 @@ public:
 		static_assert(sizeof(T) != 0, "cannot allocate incomplete types");
 	#endif
 
-		return this->manager->template allocate_type<T>(n);
+		// We call allocate through TManager instead of Manager::allocate_type,
+		// otherwise the call would always be virtual.
+		return static_cast<T*>( this->manager->allocate(calculate_size<T>(), n, calculate_alignment<T>()) );
 	}
 
 	void deallocate (T *p, const size_type n)
 	{
-		this->manager->template deallocate_type<T>(p, n);
+		this->manager->deallocate(p, calculate_size<T>(), n, calculate_alignment<T>());
 	}
 
 	template<typename Tother>
-	friend constexpr bool operator== (const AllocatorSTL&, const AllocatorSTL<Tother>&) noexcept
+	friend constexpr bool operator== (const AllocatorSTL&, const AllocatorSTL<Tother, TManager>&) noexcept
 	{
 		return true;
 	}
 
 	#if __cpp_impl_three_way_comparison < 201907L
 	template <typename Tother>
-	friend constexpr bool operator!= (const AllocatorSTL&, const AllocatorSTL<_Up>&) noexcept
+	friend constexpr bool operator!= (const AllocatorSTL&, const AllocatorSTL<Tother, TManager>&) noexcept
 	{
 		return false;
 	}
@@ -194,23 +387,23 @@ public:
 
 // To be used with unique_ptr
 
-template <typename T>
+template <typename T, ManagerType TManager = Manager>
 class DeAllocatorSTL_unique_ptr
 {
 public:
-	Manager *manager = nullptr;
+	TManager *manager = nullptr;
 	size_t type_size;
 	size_t type_align;
 
 	DeAllocatorSTL_unique_ptr () = default;
 
-	DeAllocatorSTL_unique_ptr (Manager& manager_)
+	DeAllocatorSTL_unique_ptr (TManager& manager_)
 		: manager(&manager_), type_size(calculate_size<T>()), type_align(calculate_alignment<T>())
 	{
 	}
 
 	template <typename Tother>
-	DeAllocatorSTL_unique_ptr (const DeAllocatorSTL_unique_ptr<Tother>& other)
+	DeAllocatorSTL_unique_ptr (const DeAllocatorSTL_unique_ptr<Tother, TManager>& other)
 		: manager(other.manager), type_size(other.type_size), type_align(other.type_align)
 	{
 //		std::cout << "DeAllocatorSTL_unique_ptr copy constructor from anothe type" << std::endl;
@@ -232,6 +425,7 @@ public:
 
 	void operator() (T *p)
 	{
+		p->~T();
 		//this->manager->template deallocate_type<T>(p, 1);
 		this->manager->deallocate(p, this->type_size, 1, this->type_align);
 	}
@@ -247,8 +441,8 @@ public:
 // The solution is to use a custom deleter that stores the type size and
 // alignment of the object being pointed to when the unique_ptr was created.
 
-template <typename T>
-using unique_ptr = std::unique_ptr<T, DeAllocatorSTL_unique_ptr<T>>;
+template <typename T, ManagerType TManager = Manager>
+using unique_ptr = std::unique_ptr<T, DeAllocatorSTL_unique_ptr<T, TManager>>;
 
 template <typename T, typename... Types>
 [[nodiscard]] unique_ptr<T> make_unique (Manager& manager, Types&&... vars)
@@ -257,20 +451,355 @@ template <typename T, typename... Types>
 	return unique_ptr<T>(ptr, DeAllocatorSTL_unique_ptr<T>(manager));
 }
 
+// Same as make_unique, but the unique_ptr holds the concrete manager type,
+// so the deallocation is not a virtual call.
+
+template <typename T, ManagerType TManager, typename... Types>
+[[nodiscard]] unique_ptr<T, TManager> make_unique_static (TManager& manager, Types&&... vars)
+{
+	T *ptr = new (manager.allocate(calculate_size<T>(), 1, calculate_alignment<T>())) T(std::forward<Types>(vars)...);
+	return unique_ptr<T, TManager>(ptr, DeAllocatorSTL_unique_ptr<T, TManager>(manager));
+}
+
+// ---------------------------------------------------
+
+/*
+	The unique_ptr above is 4 times the size of a pointer,
+	since the deleter stores the manager, the type size and the alignment.
+
+	compact_unique_ptr stores them in a small header allocated right before the object,
+	so the deleter has no state and compact_unique_ptr has the size of a pointer.
+	For polymorphic types, we find the beginning of the most derived object
+	(and hence the header) with dynamic_cast<void*>, so it is safe
+	even with multiple inheritance.
+	Non-polymorphic types can only be converted to a base at offset 0
+	(same limitation of delete).
+*/
+
+struct AllocationHeader {
+	Manager *manager;
+	uint32_t size; // of the whole allocation, including the header
+	uint32_t align;
+
+	static constexpr size_t calculate_offset (const size_t align) noexcept
+	{
+		// distance from the beginning of the allocation to the object
+		return ((sizeof(AllocationHeader) + align - 1) / align) * align;
+	}
+};
+
+static_assert(sizeof(AllocationHeader) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+template <typename T>
+[[nodiscard]] void* allocate_with_header (Manager& manager)
+{
+	constexpr size_t align = calculate_alignment<T>();
+	constexpr size_t offset = AllocationHeader::calculate_offset(align);
+	constexpr size_t size = offset + calculate_size<T>();
+
+	static_assert(size <= std::numeric_limits<uint32_t>::max());
+
+	uint8_t *p = static_cast<uint8_t*>( manager.allocate(size, 1, align) ) + offset;
+
+	AllocationHeader *header = reinterpret_cast<AllocationHeader*>(p) - 1;
+	header->manager = &manager;
+	header->size = static_cast<uint32_t>(size);
+	header->align = static_cast<uint32_t>(align);
+
+	return p;
+}
+
+// p must be the beginning of the most derived object
+inline void deallocate_with_header (void *p)
+{
+	const AllocationHeader *header = static_cast<const AllocationHeader*>(p) - 1;
+	const size_t offset = AllocationHeader::calculate_offset(header->align);
+
+	header->manager->deallocate(static_cast<uint8_t*>(p) - offset, header->size, 1, header->align);
+}
+
+template <typename T>
+class CompactDeleter
+{
+public:
+	CompactDeleter () = default;
+
+	template <typename Tother>
+		requires std::convertible_to<Tother*, T*>
+	CompactDeleter (const CompactDeleter<Tother>&) noexcept
+	{
+	}
+
+	void operator() (T *p) const
+	{
+		void *object;
+
+		if constexpr (std::is_polymorphic_v<T>)
+			object = dynamic_cast<void*>(p);
+		else
+			object = p;
+
+		p->~T();
+		deallocate_with_header(object);
+	}
+};
+
+template <typename T>
+using compact_unique_ptr = std::unique_ptr<T, CompactDeleter<T>>;
+
+static_assert(sizeof(compact_unique_ptr<int>) == sizeof(int*));
+
+template <typename T, typename... Types>
+[[nodiscard]] compact_unique_ptr<T> make_compact_unique (Manager& manager, Types&&... vars)
+{
+	T *ptr = new (allocate_with_header<T>(manager)) T(std::forward<Types>(vars)...);
+	return compact_unique_ptr<T>(ptr);
+}
+
 // ---------------------------------------------------
 
 class DefaultManager : public Manager
 {
+private:
+	MYLIB_MEMORY_STATS_RUN( StatsCounters stats; )
+
 public:
 	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
 	{
+		MYLIB_MEMORY_STATS_RUN( this->stats.allocated(type_size * count); )
 		return m_allocate(type_size * count, align);
 	}
 
 	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
 	{
+		MYLIB_MEMORY_STATS_RUN( this->stats.deallocated(type_size * count); )
 		m_deallocate(p, type_size * count, align);
 	}
+
+#ifdef MYLIB_MEMORY_STATS
+	Stats get_stats () const override final
+	{
+		Stats s;
+		s.total = this->stats;
+		s.fallback = this->stats;
+		s.requested_bytes = this->stats.current_bytes;
+		return s;
+	}
+#endif
+};
+
+// ---------------------------------------------------
+
+/*
+	Monotonic (bump pointer) allocator.
+
+	Memory is carved sequentially from a chain of buffers.
+	deallocate does nothing (except when freeing the last allocation),
+	and all the memory is given back at once with reset, in O(1).
+	The buffers are kept for the next round, so after the first rounds
+	(frames, ticks), no more memory is requested to the system.
+
+	When a buffer gets full, we go to the next one in the chain,
+	allocating a new buffer with twice the size of the previous one
+	(up to max_buffer_size) if there is no next buffer.
+
+	save/restore (or a Scope) rewind the arena to a previous point,
+	releasing only what was allocated after it.
+
+	Useful for per-frame temporaries.
+	It can be given to anything that receives a Manager
+	(AllocatorSTL, make_unique, event Handler, Timer, InterpolationManager),
+	as long as the objects don't outlive the next reset.
+*/
+
+class ArenaManager : public Manager
+{
+private:
+	struct MYLIB_ALIGN_STRUCT(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Buffer {
+		Buffer *next;
+		size_t size; // of the data, which comes right after the header
+
+		inline uint8_t* get_data () noexcept
+		{
+			return reinterpret_cast<uint8_t*>(this + 1);
+		}
+	};
+
+	Buffer *first_buffer;
+	Buffer *buffer; // current
+	uint8_t *top;
+	uint8_t *end;
+
+	size_t next_buffer_size;
+	const size_t max_buffer_size;
+
+	MYLIB_MEMORY_STATS_RUN( StatsCounters stats; )
+
+public:
+	struct Marker {
+		Buffer *buffer;
+		uint8_t *top;
+		MYLIB_MEMORY_STATS_RUN( size_t current_bytes; )
+	};
+
+	// Rewinds the arena when the scope ends.
+
+	class Scope
+	{
+	private:
+		ArenaManager& arena;
+		const Marker marker;
+
+	public:
+		Scope (ArenaManager& arena_)
+			: arena(arena_), marker(arena_.save())
+		{
+		}
+
+		~Scope ()
+		{
+			this->arena.restore(this->marker);
+		}
+
+		MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(Scope)
+	};
+
+	ArenaManager (const size_t buffer_size = 64 * 1024, const size_t max_buffer_size_ = 16 * 1024 * 1024)
+		: next_buffer_size(buffer_size), max_buffer_size(max_buffer_size_)
+	{
+		this->first_buffer = this->alloc_buffer(buffer_size, nullptr);
+		this->set_buffer(this->first_buffer);
+	}
+
+	~ArenaManager ()
+	{
+		Buffer *next;
+
+		for (Buffer *b = this->first_buffer; b != nullptr; b = next) {
+			next = b->next;
+			m_deallocate(b, sizeof(Buffer) + b->size, alignof(Buffer));
+		}
+	}
+
+	MYLIB_DELETE_COPY_MOVE_CONSTRUCTOR_ASSIGN(ArenaManager)
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		const size_t size = type_size * count;
+		uint8_t *p = align_up(this->top, align);
+
+		const size_t available = this->end - this->top;
+		const size_t padding = p - this->top;
+
+		if ((padding + size) > available) [[unlikely]]
+			p = this->next_buffer(size, align);
+
+		this->top = p + size;
+
+		MYLIB_MEMORY_STATS_RUN( this->stats.allocated(size); )
+
+		return p;
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		// We can only give back the memory of the last allocation.
+		// This helps containers that grow (like std::vector).
+
+		const size_t size = type_size * count;
+
+		if ((static_cast<uint8_t*>(p) + size) == this->top) {
+			this->top = static_cast<uint8_t*>(p);
+			MYLIB_MEMORY_STATS_RUN( this->stats.deallocated(size); )
+		}
+		else {
+			MYLIB_MEMORY_STATS_RUN( this->stats.n_deallocations++; )
+		}
+	}
+
+	// releases all the allocated memory, keeping the buffers
+	inline void reset () noexcept
+	{
+		this->set_buffer(this->first_buffer);
+		MYLIB_MEMORY_STATS_RUN( this->stats.current_bytes = 0; )
+	}
+
+	inline Marker save () const noexcept
+	{
+		return Marker {
+			.buffer = this->buffer,
+			.top = this->top,
+			MYLIB_MEMORY_STATS_RUN( .current_bytes = this->stats.current_bytes )
+		};
+	}
+
+	// releases everything allocated after the marker was saved
+	inline void restore (const Marker& marker) noexcept
+	{
+		this->buffer = marker.buffer;
+		this->top = marker.top;
+		this->end = marker.buffer->get_data() + marker.buffer->size;
+		MYLIB_MEMORY_STATS_RUN( this->stats.current_bytes = marker.current_bytes; )
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	Stats get_stats () const override final
+	{
+		Stats s;
+
+		s.total = this->stats;
+		s.requested_bytes = this->stats.current_bytes;
+
+		for (const Buffer *b = this->first_buffer; b != nullptr; b = b->next) {
+			s.n_allocated_blocks++;
+			s.block_bytes += b->size;
+		}
+
+		return s;
+	}
+#endif
+
+private:
+	static inline uint8_t* align_up (uint8_t *p, const size_t align) noexcept
+	{
+		return reinterpret_cast<uint8_t*>( (reinterpret_cast<uintptr_t>(p) + (align - 1)) & ~static_cast<uintptr_t>(align - 1) );
+	}
+
+	inline void set_buffer (Buffer *b) noexcept
+	{
+		this->buffer = b;
+		this->top = b->get_data();
+		this->end = this->top + b->size;
+	}
+
+	Buffer* alloc_buffer (const size_t size, Buffer *next)
+	{
+		Buffer *b = new (m_allocate(sizeof(Buffer) + size, alignof(Buffer))) Buffer;
+		b->next = next;
+		b->size = size;
+		return b;
+	}
+
+	uint8_t* next_buffer (const size_t size, const size_t align)
+	{
+		const size_t required = size + align; // worst case padding
+
+		// the buffers after the current one are reused after a reset/restore
+
+		Buffer *next = this->buffer->next;
+
+		if (next == nullptr || next->size < required) {
+			if (this->next_buffer_size < this->max_buffer_size)
+				this->next_buffer_size = std::min(this->next_buffer_size * 2, this->max_buffer_size);
+
+			next = this->alloc_buffer(std::max(this->next_buffer_size, required), next);
+			this->buffer->next = next;
+		}
+
+		this->set_buffer(next);
+
+		return align_up(this->top, align);
+	}
 };
 
 // ---------------------------------------------------
@@ -280,6 +809,96 @@ inline AllocatorSTL<int> default_allocator_stl(default_manager);
 
 // ---------------------------------------------------
 
+/*
+	Bridges between Manager and std::pmr::memory_resource.
+
+	ManagerMemoryResource exposes a Manager as a memory_resource,
+	so std::pmr containers can use our pools and arenas:
+
+	Mylib::Memory::ManagerMemoryResource resource(pool_manager);
+	std::pmr::vector<int> v(&resource);
+
+	pmr only talks in bytes, so every request is a single allocation
+	of bytes (count == 1).
+	This way, a pmr::vector buffer is always contiguous, and managers
+	that don't support count > 1 (ConcurrentPoolManager) work as well.
+
+	Requests with alignment greater than __STDCPP_DEFAULT_NEW_ALIGNMENT__ go to operator new,
+	since the pools only guarantee the alignment of their size classes.
+*/
+
+class ManagerMemoryResource : public std::pmr::memory_resource
+{
+private:
+	Manager& manager;
+
+public:
+	ManagerMemoryResource (Manager& manager_) noexcept
+		: manager(manager_)
+	{
+	}
+
+	Manager& get_manager () const noexcept
+	{
+		return this->manager;
+	}
+
+protected:
+	void* do_allocate (const size_t bytes, const size_t alignment) override final
+	{
+		if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) [[unlikely]]
+			return ::operator new(bytes, std::align_val_t(alignment));
+
+		return this->manager.allocate(bytes, 1, alignment);
+	}
+
+	void do_deallocate (void *p, const size_t bytes, const size_t alignment) override final
+	{
+		if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) [[unlikely]]
+			::operator delete(p, bytes, std::align_val_t(alignment));
+		else
+			this->manager.deallocate(p, bytes, 1, alignment);
+	}
+
+	bool do_is_equal (const std::pmr::memory_resource& other) const noexcept override final
+	{
+		const ManagerMemoryResource *other_resource = dynamic_cast<const ManagerMemoryResource*>(&other);
+		return (other_resource != nullptr && &other_resource->manager == &this->manager);
+	}
+};
+
+// The other way around: any memory_resource used as a Manager.
+// count elements are requested as a single block of type_size * count bytes.
+
+class MemoryResourceManager : public Manager
+{
+private:
+	std::pmr::memory_resource *resource;
+
+public:
+	MemoryResourceManager (std::pmr::memory_resource *resource_ = std::pmr::get_default_resource()) noexcept
+		: resource(resource_)
+	{
+	}
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		return this->resource->allocate(type_size * count, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		this->resource->deallocate(p, type_size * count, align);
+	}
+
+	std::pmr::memory_resource* get_resource () const noexcept
+	{
+		return this->resource;
+	}
+};
+
+// ---------------------------------------------------
+
 
 } // end namespace Memory
 } // end namespace Mylib
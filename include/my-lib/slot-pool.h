@@ -0,0 +1,438 @@
+#ifndef __MY_LIB_SLOT_POOL_HEADER_H__
+#define __MY_LIB_SLOT_POOL_HEADER_H__
+
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <concepts>
+#include <type_traits>
+#include <limits>
+#include <bit>
+
+#include <cstdint>
+#include <cstddef>
+
+#include <my-lib/macros.h>
+#include <my-lib/std.h>
+#include <my-lib/exception.h>
+#include <my-lib/memory.h>
+
+
+namespace Mylib
+{
+
+// ---------------------------------------------------
+
+/*
+	Handle of an object of a SlotPool.
+	The low index_bits are the index of the slot, and the rest is
+	the generation of the slot when the object was created.
+
+	The value 0 is the null handle, and is never valid.
+*/
+
+template <std::unsigned_integral Tvalue, uint32_t index_bits_>
+struct SlotHandle {
+	static constexpr uint32_t index_bits = index_bits_;
+	static constexpr uint32_t generation_bits = sizeof(Tvalue) * 8 - index_bits;
+	static constexpr Tvalue index_mask = (static_cast<Tvalue>(1) << index_bits) - 1;
+	static constexpr Tvalue max_index = index_mask;
+
+	static_assert(index_bits > 0 && generation_bits > 0);
+
+	Tvalue value = 0;
+
+	static constexpr SlotHandle make (const Tvalue index, const Tvalue generation) noexcept
+	{
+		return SlotHandle { .value = static_cast<Tvalue>((generation << index_bits) | index) };
+	}
+
+	constexpr Tvalue get_index () const noexcept
+	{
+		return this->value & index_mask;
+	}
+
+	constexpr Tvalue get_generation () const noexcept
+	{
+		return this->value >> index_bits;
+	}
+
+	constexpr bool is_null () const noexcept
+	{
+		return (this->value == 0);
+	}
+
+	constexpr bool operator== (const SlotHandle& other) const noexcept = default;
+};
+
+// ---------------------------------------------------
+
+/*
+	Pool of objects of type T, referenced by handles (SlotHandle)
+	instead of pointers.
+
+	The objects are stored in blocks of slots_per_block slots.
+	Blocks are never moved or released before the pool is destroyed,
+	so pointers to the objects are stable as well.
+
+	Each slot has a generation counter, incremented when an object is created
+	and when it is destroyed, so odd generations mean the slot is in use.
+	A handle is valid while the generation of its slot is the one
+	stored in the handle, which is checked in O(1), without any refcounting.
+	After 2^generation_bits / 2 reuses of the same slot, an old handle
+	may become valid again, so use 64-bit handles when this matters.
+
+	Freed slots are reused in LIFO order, so the live objects stay densely packed.
+*/
+
+template <typename T, std::unsigned_integral Tvalue = uint64_t, uint32_t index_bits = (sizeof(Tvalue) == 8) ? 32 : 20, uint32_t slots_per_block = 256>
+class SlotPool
+{
+public:
+	using Handle = SlotHandle<Tvalue, index_bits>;
+	using Type = T;
+
+	static_assert(std::has_single_bit(slots_per_block));
+
+private:
+	static constexpr uint32_t block_shift = std::countr_zero(slots_per_block);
+	static constexpr uint32_t block_mask = slots_per_block - 1;
+	static constexpr Tvalue generation_mask = (static_cast<Tvalue>(1) << Handle::generation_bits) - 1;
+
+	struct Slot {
+		union {
+			T object;
+			Tvalue next_free;
+		};
+
+		Tvalue generation;
+
+		Slot () noexcept
+			: next_free(0), generation(0)
+		{
+		}
+
+		~Slot ()
+		{
+		}
+
+		bool is_alive () const noexcept
+		{
+			return (this->generation & 0x01);
+		}
+	};
+
+	static constexpr Tvalue no_slot = std::numeric_limits<Tvalue>::max();
+
+	Memory::Manager *manager;
+	std::vector<Slot*> blocks;
+	Tvalue n_slots = 0; // slots already handed out at least once
+	Tvalue free_slots = no_slot; // head of the list of freed slots
+
+	MYLIB_OO_ENCAPSULATE_SCALAR_INIT_READONLY(Tvalue, size, 0) // number of live objects
+
+public:
+	SlotPool (Memory::Manager& manager_ = Memory::default_manager)
+		: manager(&manager_)
+	{
+	}
+
+	SlotPool (const SlotPool&) = delete;
+	SlotPool& operator= (const SlotPool&) = delete;
+
+	// the handles keep working in the new pool
+	SlotPool (SlotPool&& other) noexcept
+		: manager(other.manager),
+		  blocks(std::move(other.blocks)),
+		  n_slots(other.n_slots),
+		  free_slots(other.free_slots),
+		  size(other.size)
+	{
+		other.blocks.clear();
+		other.n_slots = 0;
+		other.free_slots = no_slot;
+		other.size = 0;
+	}
+
+	SlotPool& operator= (SlotPool&& other) noexcept
+	{
+		if (this != &other) {
+			this->release();
+
+			this->manager = other.manager;
+			this->blocks = std::move(other.blocks);
+			this->n_slots = other.n_slots;
+			this->free_slots = other.free_slots;
+			this->size = other.size;
+
+			other.blocks.clear();
+			other.n_slots = 0;
+			other.free_slots = no_slot;
+			other.size = 0;
+		}
+
+		return *this;
+	}
+
+	~SlotPool ()
+	{
+		this->release();
+	}
+
+	template <typename... Types>
+	Handle create (Types&&... args)
+	{
+		const bool reuse = (this->free_slots != no_slot);
+		Tvalue index;
+
+		if (reuse)
+			index = this->free_slots;
+		else {
+			mylib_assert_msg(this->n_slots <= Handle::max_index, "SlotPool is full, use more index bits")
+
+			if ((this->n_slots >> block_shift) == this->blocks.size())
+				this->alloc_new_block();
+
+			index = this->n_slots;
+		}
+
+		Slot& slot = this->get_slot(index);
+		const Tvalue next_free = slot.next_free; // the object overwrites it
+
+		// if the constructor throws, the slot is still free
+		new (&slot.object) T(std::forward<Types>(args)...);
+
+		if (reuse)
+			this->free_slots = next_free;
+		else
+			this->n_slots++;
+
+		slot.generation++;
+		this->size++;
+
+		return Handle::make(index, slot.generation & generation_mask);
+	}
+
+	void destroy (const Handle handle)
+	{
+		mylib_assert_msg(this->is_valid(handle), "destroying an invalid SlotPool handle ", handle.value)
+
+		const Tvalue index = handle.get_index();
+		Slot& slot = this->get_slot(index);
+
+		slot.object.~T();
+		slot.generation++;
+		slot.next_free = this->free_slots;
+		this->free_slots = index;
+		this->size--;
+	}
+
+	bool is_valid (const Handle handle) const noexcept
+	{
+		const Tvalue index = handle.get_index();
+
+		if (index >= this->n_slots) [[unlikely]]
+			return false;
+
+		const Slot& slot = this->get_slot(index);
+
+		return slot.is_alive() && ((slot.generation & generation_mask) == handle.get_generation());
+	}
+
+	// nullptr if the handle is not valid anymore
+	T* get (const Handle handle) noexcept
+	{
+		return this->is_valid(handle) ? &this->get_slot(handle.get_index()).object : nullptr;
+	}
+
+	const T* get (const Handle handle) const noexcept
+	{
+		return this->is_valid(handle) ? &this->get_slot(handle.get_index()).object : nullptr;
+	}
+
+	// the handle must be valid
+	T& operator[] (const Handle handle) noexcept
+	{
+		return this->get_slot(handle.get_index()).object;
+	}
+
+	const T& operator[] (const Handle handle) const noexcept
+	{
+		return this->get_slot(handle.get_index()).object;
+	}
+
+	// Handle of an object of the pool, from its address.
+	Handle get_handle (const T *ptr) const
+	{
+		// the object is at the beginning of its slot
+		const Slot *slot = reinterpret_cast<const Slot*>(ptr);
+
+		for (Tvalue b = 0; b < this->blocks.size(); b++) {
+			const Slot *block = this->blocks[b];
+
+			if (slot >= block && slot < (block + slots_per_block))
+				return Handle::make((b << block_shift) | static_cast<Tvalue>(slot - block), slot->generation & generation_mask);
+		}
+
+		mylib_throw_msg(AssertException, "object doesn't belong to the SlotPool");
+	}
+
+	void clear ()
+	{
+		this->for_each([this] (const Handle handle, T&) {
+			this->destroy(handle);
+		});
+	}
+
+	Tvalue get_capacity () const noexcept
+	{
+		return this->blocks.size() * slots_per_block;
+	}
+
+	// Calls func(handle, object) for each live object, in slot order.
+	// Destroying the current object inside func is allowed.
+
+	template <typename Tfunc>
+	void for_each (Tfunc&& func)
+	{
+		for (Tvalue index = 0; index < this->n_slots; index++) {
+			Slot& slot = this->get_slot(index);
+
+			if (slot.is_alive())
+				func(Handle::make(index, slot.generation & generation_mask), slot.object);
+		}
+	}
+
+	// Iterator over the live objects.
+
+	template <bool is_const>
+	class Iterator
+	{
+	private:
+		using Pool = std::conditional_t<is_const, const SlotPool, SlotPool>;
+
+		Pool *pool;
+		Tvalue index;
+
+	public:
+		using iterator_category = std::forward_iterator_tag;
+		using value_type = T;
+		using difference_type = std::ptrdiff_t;
+		using pointer = std::conditional_t<is_const, const T*, T*>;
+		using reference = std::conditional_t<is_const, const T&, T&>;
+
+		Iterator () noexcept
+			: pool(nullptr), index(0)
+		{
+		}
+
+		Iterator (Pool *pool_, const Tvalue index_) noexcept
+			: pool(pool_), index(index_)
+		{
+			this->skip_dead();
+		}
+
+		reference operator* () const noexcept
+		{
+			return this->pool->get_slot(this->index).object;
+		}
+
+		pointer operator-> () const noexcept
+		{
+			return &this->pool->get_slot(this->index).object;
+		}
+
+		Iterator& operator++ () noexcept
+		{
+			this->index++;
+			this->skip_dead();
+			return *this;
+		}
+
+		Iterator operator++ (int) noexcept
+		{
+			Iterator tmp = *this;
+			++(*this);
+			return tmp;
+		}
+
+		Handle get_handle () const noexcept
+		{
+			return Handle::make(this->index, this->pool->get_slot(this->index).generation & generation_mask);
+		}
+
+		bool operator== (const Iterator& other) const noexcept
+		{
+			return (this->index == other.index);
+		}
+
+	private:
+		void skip_dead () noexcept
+		{
+			while (this->index < this->pool->n_slots && !this->pool->get_slot(this->index).is_alive())
+				this->index++;
+		}
+	};
+
+	using iterator = Iterator<false>;
+	using const_iterator = Iterator<true>;
+
+	iterator begin () noexcept
+	{
+		return iterator(this, 0);
+	}
+
+	iterator end () noexcept
+	{
+		return iterator(this, this->n_slots);
+	}
+
+	const_iterator begin () const noexcept
+	{
+		return const_iterator(this, 0);
+	}
+
+	const_iterator end () const noexcept
+	{
+		return const_iterator(this, this->n_slots);
+	}
+
+private:
+	inline Slot& get_slot (const Tvalue index) noexcept
+	{
+		return this->blocks[index >> block_shift][index & block_mask];
+	}
+
+	inline const Slot& get_slot (const Tvalue index) const noexcept
+	{
+		return this->blocks[index >> block_shift][index & block_mask];
+	}
+
+	void release ()
+	{
+		this->clear();
+
+		for (Slot *block : this->blocks)
+			this->manager->template deallocate_type<Slot>(block, slots_per_block);
+
+		this->blocks.clear();
+		this->n_slots = 0;
+		this->free_slots = no_slot;
+	}
+
+	void alloc_new_block ()
+	{
+		Slot *block = this->manager->template allocate_type<Slot>(slots_per_block);
+
+		for (uint32_t i = 0; i < slots_per_block; i++)
+			new (&block[i]) Slot;
+
+		this->blocks.push_back(block);
+	}
+};
+
+// ---------------------------------------------------
+
+} // end namespace Mylib
+
+#endif
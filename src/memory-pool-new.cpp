@@ -0,0 +1,228 @@
+/*
+	Replacement of the global operator new/delete by a PoolManager.
+
+	Link it in the executable, or build it as a shared library
+	(make pool-preload) and load it with LD_PRELOAD:
+
+	LD_PRELOAD=./libmylib-pool-new.so ./my-program
+
+	Sizes up to max_type_size with the default alignment are served by the pools,
+	and the rest goes to malloc.
+	The pools use BlockBackend::Segments, so operator delete finds the pool
+	of a pointer in the segment_map without the size, and forwards everything
+	else to free.
+
+	The PoolManager is not thread-safe, so all calls to it are serialized by a mutex.
+	It is a recursive mutex because the PoolManager may allocate memory
+	itself while holding it (the lists of free runs, for instance).
+*/
+
+#include <new>
+#include <mutex>
+
+#include <cstdlib>
+
+#include <my-lib/memory-pool.h>
+
+using Mylib::Memory::PoolManager;
+using Mylib::Memory::BlockPolicy;
+using Mylib::Memory::BlockBackend;
+using Mylib::Memory::segment_map;
+
+// ---------------------------------------------------
+
+namespace {
+
+constexpr size_t max_type_size = 256;
+constexpr size_t step_size = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+// The blocks are rounded up to whole segments, so a default_block_size block
+// takes a full segment.
+// The manager is created on the first allocation and never destroyed,
+// since there may be deallocations after the static destructors run.
+
+alignas(PoolManager) unsigned char manager_storage[sizeof(PoolManager)];
+PoolManager *manager = nullptr;
+bool initializing = false;
+
+std::recursive_mutex& get_mutex ()
+{
+	static std::recursive_mutex mutex;
+	return mutex;
+}
+
+void* pool_allocate (const size_t size) noexcept
+{
+	std::scoped_lock lock(get_mutex());
+
+	// While the manager is being constructed, its own allocations go to malloc.
+	if (initializing) [[unlikely]]
+		return std::malloc(size);
+
+	if (manager == nullptr) [[unlikely]] {
+		initializing = true;
+		manager = new (manager_storage) PoolManager(max_type_size, step_size, Mylib::Memory::default_block_size, BlockPolicy { .backend = BlockBackend::Segments });
+		initializing = false;
+	}
+
+	try {
+		return manager->allocate(size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	}
+	catch (const std::bad_alloc&) {
+		return nullptr;
+	}
+}
+
+void* new_allocate (size_t size) noexcept
+{
+	if (size == 0)
+		size = 1;
+
+	if (size <= max_type_size)
+		return pool_allocate(size);
+
+	return std::malloc(size);
+}
+
+void* new_allocate_aligned (size_t size, const size_t align) noexcept
+{
+	if (align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+		return new_allocate(size);
+
+	if (size == 0)
+		size = 1;
+
+	// aligned_alloc requires the size to be a multiple of the alignment
+	return std::aligned_alloc(align, ((size + align - 1) / align) * align);
+}
+
+void new_deallocate (void *p) noexcept
+{
+	if (p == nullptr)
+		return;
+
+	// The segment_map is lock-free, so pointers not owned by the pools
+	// don't need the mutex.
+	if (segment_map.find(p) != nullptr) {
+		std::scoped_lock lock(get_mutex());
+		manager->deallocate(p);
+	}
+	else
+		std::free(p);
+}
+
+} // end anonymous namespace
+
+// ---------------------------------------------------
+
+void* operator new (size_t size)
+{
+	void *p = new_allocate(size);
+
+	if (p == nullptr) [[unlikely]]
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void* operator new[] (size_t size)
+{
+	return ::operator new(size);
+}
+
+void* operator new (size_t size, const std::nothrow_t&) noexcept
+{
+	return new_allocate(size);
+}
+
+void* operator new[] (size_t size, const std::nothrow_t&) noexcept
+{
+	return new_allocate(size);
+}
+
+void* operator new (size_t size, std::align_val_t align)
+{
+	void *p = new_allocate_aligned(size, static_cast<size_t>(align));
+
+	if (p == nullptr) [[unlikely]]
+		throw std::bad_alloc();
+
+	return p;
+}
+
+void* operator new[] (size_t size, std::align_val_t align)
+{
+	return ::operator new(size, align);
+}
+
+void* operator new (size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return new_allocate_aligned(size, static_cast<size_t>(align));
+}
+
+void* operator new[] (size_t size, std::align_val_t align, const std::nothrow_t&) noexcept
+{
+	return new_allocate_aligned(size, static_cast<size_t>(align));
+}
+
+// ---------------------------------------------------
+
+void operator delete (void *p) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete (void *p, size_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p, size_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete (void *p, const std::nothrow_t&) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p, const std::nothrow_t&) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete (void *p, std::align_val_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p, std::align_val_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete (void *p, size_t, std::align_val_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p, size_t, std::align_val_t) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete (void *p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	new_deallocate(p);
+}
+
+void operator delete[] (void *p, std::align_val_t, const std::nothrow_t&) noexcept
+{
+	new_deallocate(p);
+}
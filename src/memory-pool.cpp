@@ -1,4 +1,15 @@
 #include <algorithm>
+#include <fstream>
+#include <new>
+#include <unordered_set>
+
+#if defined(__linux__)
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <sched.h>
+	#include <linux/mempolicy.h>
+#endif
 
 #include <my-lib/memory-pool.h>
 
@@ -9,11 +20,226 @@ namespace Memory
 
 // ---------------------------------------------------
 
-PoolCore::PoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_)
+static constexpr size_t round_up_size (const size_t size, const size_t align) noexcept
+{
+	return ((size + align - 1) / align) * align;
+}
+
+// ---------------------------------------------------
+
+void SegmentMap::insert (const void *p, const size_t size, PoolCore *pool)
+{
+	const uintptr_t first = reinterpret_cast<uintptr_t>(p) >> segment_bits;
+	const uintptr_t last = first + (size >> segment_bits);
+
+	for (uintptr_t segment = first; segment < last; segment++) {
+		const uintptr_t root_i = segment >> leaf_bits;
+
+		mylib_assert_msg(root_i < std::size(this->root), "address ", p, " is out of the range of the segment map")
+
+		PoolCore **leaf = this->root[root_i].load(std::memory_order_acquire);
+
+		if (leaf == nullptr) {
+			PoolCore **new_leaf = static_cast<PoolCore**>( std::calloc(static_cast<size_t>(1) << leaf_bits, sizeof(PoolCore*)) );
+
+			if (new_leaf == nullptr) [[unlikely]]
+				throw std::bad_alloc();
+
+			// another thread may have created the leaf in the meantime
+			if (this->root[root_i].compare_exchange_strong(leaf, new_leaf, std::memory_order_acq_rel, std::memory_order_acquire))
+				leaf = new_leaf;
+			else
+				std::free(new_leaf);
+		}
+
+		std::atomic_ref<PoolCore*>(leaf[segment & leaf_mask]).store(pool, std::memory_order_release);
+	}
+}
+
+void SegmentMap::erase (const void *p, const size_t size)
+{
+	const uintptr_t first = reinterpret_cast<uintptr_t>(p) >> segment_bits;
+	const uintptr_t last = first + (size >> segment_bits);
+
+	for (uintptr_t segment = first; segment < last; segment++) {
+		PoolCore **leaf = this->root[segment >> leaf_bits].load(std::memory_order_acquire);
+		std::atomic_ref<PoolCore*>(leaf[segment & leaf_mask]).store(nullptr, std::memory_order_release);
+	}
+}
+
+// ---------------------------------------------------
+
+uint32_t get_numa_n_nodes ()
+{
+	static const uint32_t n_nodes = [] () -> uint32_t {
+	#if defined(__linux__)
+		// "0" or "0-1", for instance
+		std::ifstream file("/sys/devices/system/node/online");
+		std::string nodes;
+
+		if (file >> nodes) {
+			const size_t pos = nodes.find_last_of("-,");
+			return std::stoul(nodes.substr((pos == std::string::npos) ? 0 : pos + 1)) + 1;
+		}
+	#endif
+		return 1;
+	}();
+
+	return n_nodes;
+}
+
+uint32_t get_numa_current_node ()
+{
+#if defined(__linux__)
+	unsigned int cpu, node;
+
+	if (getcpu(&cpu, &node) == 0)
+		return node;
+#endif
+
+	return 0;
+}
+
+#if defined(__linux__)
+
+// The binding must be done before the memory is touched, since it doesn't
+// move the pages that are already placed (no MPOL_MF_MOVE).
+// p and size must be page aligned.
+
+static void bind_block_memory (void *p, const size_t size, const uint32_t node)
+{
+	constexpr uint32_t bits_per_mask = sizeof(unsigned long) * 8;
+	constexpr uint32_t max_nodes = 1024; // MAX_NUMNODES of the kernel
+
+	if (node >= max_nodes)
+		return;
+
+	unsigned long nodemask[max_nodes / bits_per_mask] = {};
+	nodemask[node / bits_per_mask] = 1ul << (node % bits_per_mask);
+
+	// It is just a hint for the kernel, so we ignore failures
+	// (a kernel without NUMA support, for instance).
+	syscall(SYS_mbind, p, size, MPOL_PREFERRED, nodemask, max_nodes + 1, 0);
+}
+
+// Since mmap only guarantees page alignment, we map an extra alignment
+// and unmap the misaligned head and tail.
+
+static void* map_aligned_memory (const size_t size, const size_t alignment)
+{
+	const size_t mapped_size = size + alignment;
+	void *mapped = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (mapped == MAP_FAILED) [[unlikely]]
+		throw std::bad_alloc();
+
+	uint8_t *start = static_cast<uint8_t*>(mapped);
+	uint8_t *aligned = reinterpret_cast<uint8_t*>( round_up_size(reinterpret_cast<uintptr_t>(start), alignment) );
+	uint8_t *end = start + mapped_size;
+
+	if (aligned > start)
+		munmap(start, aligned - start);
+
+	if (end > (aligned + size))
+		munmap(aligned + size, end - (aligned + size));
+
+	return aligned;
+}
+
+#endif
+
+// HugePages blocks and the blocks bound to a NUMA node are mmap'ed.
+// The bound ones because memory from malloc may be recycled pages that
+// are already placed on another node, and mbind would also split the malloc heap.
+
+static bool is_block_memory_mapped (const BlockPolicy& policy) noexcept
+{
+#if defined(__linux__)
+	return (policy.backend == BlockBackend::HugePages) || (policy.numa != NumaBinding::None);
+#else
+	(void)policy;
+	return false;
+#endif
+}
+
+// ---------------------------------------------------
+
+static void* alloc_block_memory (const size_t size, const size_t align, const BlockPolicy& policy, size_t& allocated_size)
+{
+#if defined(__linux__)
+	if (is_block_memory_mapped(policy)) {
+		const size_t page_size = sysconf(_SC_PAGESIZE);
+		size_t alignment;
+
+		// To be backed by transparent huge pages, the memory must be 2MB aligned.
+
+		if (policy.backend == BlockBackend::HugePages)
+			alignment = huge_page_size;
+		else if (policy.backend == BlockBackend::Segments)
+			alignment = segment_size;
+		else
+			alignment = (align > page_size) ? align : page_size;
+
+		allocated_size = round_up_size(size, alignment);
+
+		void *p = map_aligned_memory(allocated_size, alignment);
+
+		// nothing was written to the block yet (not even the header of the Segments backend)
+		if (policy.numa != NumaBinding::None) {
+			const uint32_t node = (policy.numa == NumaBinding::LocalNode) ? get_numa_current_node() : policy.numa_node;
+			bind_block_memory(p, allocated_size, node);
+		}
+
+		if (policy.backend == BlockBackend::HugePages)
+			madvise(p, allocated_size, MADV_HUGEPAGE);
+
+		return p;
+	}
+#endif
+
+	if (policy.backend == BlockBackend::Segments) {
+		allocated_size = round_up_size(size, segment_size);
+
+		// not m_allocate, since operator new may be served by the pools themselves
+		void *p = std::aligned_alloc(segment_size, allocated_size);
+
+		if (p == nullptr) [[unlikely]]
+			throw std::bad_alloc();
+
+		return p;
+	}
+
+	allocated_size = size;
+	return m_allocate(size, align);
+}
+
+static void free_block_memory (void *p, const size_t size, const size_t align, const BlockPolicy& policy)
+{
+#if defined(__linux__)
+	if (is_block_memory_mapped(policy)) {
+		munmap(p, size);
+		return;
+	}
+#endif
+
+	if (policy.backend == BlockBackend::Segments) {
+		std::free(p);
+		return;
+	}
+
+	m_deallocate(p, size, align);
+}
+
+// ---------------------------------------------------
+
+PoolCore::PoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_, const BlockPolicy& block_policy_)
 	: type_size(type_size_), chunks_per_block(chunks_per_block_), align(align_),
-	  chunk_size((type_size_ < lowest_chunk_size()) ? lowest_chunk_size() : type_size_)
+	  chunk_size(round_up_size((type_size_ < lowest_chunk_size()) ? lowest_chunk_size() : type_size_, align_)),
+	  block_policy(block_policy_),
+	  next_block_chunks(chunks_per_block_)
 {
-	// we need space to store at least a pointer in each chunk, for the linked list of free chunks
+	// we need space to store at least a pointer in each chunk, for the linked list of free chunks.
+	// The chunks are also padded to the alignment, so all of them are aligned.
 }
 
 PoolCore::~PoolCore ()
@@ -22,301 +248,1514 @@ PoolCore::~PoolCore ()
 
 	for (block = this->blocks; block != nullptr; block = next) {
 		next = block->next_block;
-		m_deallocate(block->chunks, this->chunk_size * this->chunks_per_block, this->align);
-		delete block;
+		this->free_block(block);
 	}
+
+	std::free(this->blocks_index);
 }
 
-void PoolCore::alloc_new_block ()
+void PoolCore::grow_blocks_index ()
 {
-	Block *new_block;
-	
-	new_block = new Block;
-	this->alloc_chunks_for_block(new_block);
-	new_block->next_block = this->blocks;
-	this->blocks = new_block;
+	const uint32_t capacity = (this->blocks_index_capacity == 0) ? 16 : this->blocks_index_capacity * 2;
+	Block **index = static_cast<Block**>( std::realloc(this->blocks_index, capacity * sizeof(Block*)) );
+
+	if (index == nullptr) [[unlikely]]
+		throw std::bad_alloc();
+
+	this->blocks_index = index;
+	this->blocks_index_capacity = capacity;
 }
 
-void PoolCore::alloc_chunks_for_block (Block *block)
+void PoolCore::alloc_new_block (const uint32_t min_chunks)
 {
-	Chunk *chunk;
+	Block *new_block;
+	uint32_t n_chunks = this->next_block_chunks;
 
-	// First, we allocate memory for #chunks_per_block elements.
+	if (n_chunks < min_chunks)
+		n_chunks = min_chunks;
+
+	// before anything else, so a failure leaves the pool untouched
+	if (this->n_blocks == this->blocks_index_capacity)
+		this->grow_blocks_index();
+
+	// First, we allocate memory for #n_chunks elements.
 	// Remember that we don't use sizeof(T) because we need memory for at least a pointer.
-	// When the chunk is empty, it is part of the free_chunks linked_list.
-	// When we remove an element, we remove its memory from the free_chunks linked list
-	//   and use the memory to store user data instead.
+	// We don't touch the memory here. The chunks are served from the
+	// untouched region first, and only go to the free_chunks list once freed.
 
-	block->chunks = static_cast<Chunk*>( m_allocate(this->chunk_size * this->chunks_per_block, this->align) );
+	// With block coloring, the chunks of each block start at a different
+	// cache line offset, so the same chunk of different blocks doesn't
+	// always fall in the same cache sets.
 
-	chunk = block->chunks;
+	size_t color_offset = 0;
 
-	static_assert(sizeof(uint8_t) == 1);
+	if (this->block_policy.n_colors > 1) {
+		color_offset = (this->next_color % this->block_policy.n_colors) * round_up_size(cache_line_size, this->align);
+		this->next_color++;
+	}
 
-	for (uint32_t i = 0; i < this->chunks_per_block-1; i++) {
-		chunk->next_chunk = reinterpret_cast<Chunk*>( reinterpret_cast<uint8_t*>(chunk) + this->chunk_size );
-		chunk = chunk->next_chunk;
+	if (this->block_policy.backend == BlockBackend::Segments) {
+		// The block header lives at the start of the segment, so the
+		// pools never call operator new themselves, which matters when
+		// they are the ones serving operator new (see memory-pool-new.cpp).
+
+		const size_t header_size = round_up_size(sizeof(Block), this->align) + color_offset;
+		size_t allocated_size;
+
+		void *memory = alloc_block_memory(header_size + this->chunk_size * n_chunks, this->align, this->block_policy, allocated_size);
+
+		new_block = new (memory) Block;
+		new_block->memory = static_cast<uint8_t*>(memory);
+		new_block->size = allocated_size;
+		new_block->chunks = reinterpret_cast<Chunk*>( new_block->memory + header_size );
+		new_block->n_chunks = static_cast<uint32_t>((allocated_size - header_size) / this->chunk_size);
+
+		segment_map.insert(memory, allocated_size, this);
+	}
+	else {
+		new_block = new Block;
+		new_block->memory = static_cast<uint8_t*>( alloc_block_memory(color_offset + this->chunk_size * n_chunks, this->align, this->block_policy, new_block->size) );
+		new_block->chunks = reinterpret_cast<Chunk*>( new_block->memory + color_offset );
+
+		// the backend may give us more memory than requested (huge pages), so we use all of it
+		new_block->n_chunks = static_cast<uint32_t>((new_block->size - color_offset) / this->chunk_size);
 	}
 
-	/*
-		now, we setup the last allocated chunk
+	new_block->free_chunks = nullptr;
+	new_block->n_free_chunks = 0;
+	new_block->previous_partial_block = nullptr;
+	new_block->next_partial_block = nullptr;
 
-		when free_chunks is empty, last chunk points to nothing
-		when free_chunks still has chunks, we merge the lists
-	*/
-	
-	chunk->next_chunk = this->free_chunks;
-	this->free_chunks = block->chunks;
-}
+	new_block->previous_block = nullptr;
+	new_block->next_block = this->blocks;
+	if (this->blocks != nullptr)
+		this->blocks->previous_block = new_block;
+	this->blocks = new_block;
 
-// ---------------------------------------------------
+	// new blocks usually come after the older ones, so it is mostly an append
+	Block **index_end = this->blocks_index + this->n_blocks;
+	Block **it = std::upper_bound(this->blocks_index, index_end, new_block,
+		[] (const Block *a, const Block *b) -> bool {
+			return (a->chunks < b->chunks);
+		}
+	);
+	std::move_backward(it, index_end, index_end + 1);
+	*it = new_block;
 
-PoolManager::PoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size)
-{
-	std::vector<size_t> v(list_type_sizes.begin(), list_type_sizes.end());
-	this->load(v, max_block_size);
+	this->n_blocks++;
+
+	MYLIB_MEMORY_STATS_RUN( this->stats.n_allocated_blocks++; )
+	MYLIB_MEMORY_STATS_RUN( this->stats.block_bytes += new_block->size; )
+
+	this->retire_untouched_chunks();
+
+	this->untouched_chunks = reinterpret_cast<uint8_t*>(new_block->chunks);
+	this->untouched_chunks_end = this->untouched_chunks + new_block->n_chunks * this->chunk_size;
+	this->untouched_block = new_block;
+
+	if (this->block_policy.growth == BlockGrowth::Doubling) {
+		const size_t max_chunks = this->block_policy.max_block_size / this->chunk_size;
+
+		if ((static_cast<size_t>(this->next_block_chunks) * 2) <= max_chunks)
+			this->next_block_chunks *= 2;
+		else if (max_chunks > this->next_block_chunks)
+			this->next_block_chunks = static_cast<uint32_t>(max_chunks);
+	}
 }
 
-PoolManager::PoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size)
+void PoolCore::reserve (const uint32_t n)
 {
-	std::vector<size_t> v(list_type_sizes);
-	this->load(v, max_block_size);
+	const size_t n_untouched = (this->untouched_chunks_end - this->untouched_chunks) / this->chunk_size;
+
+	if (n_untouched < n)
+		this->alloc_new_block(n);
 }
 
-PoolManager::PoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size)
+void PoolCore::refill ()
 {
-	std::vector<size_t> list_type_sizes;
+	// The chunks that trim kept in their blocks are used before allocating a new block.
+	// The free list is empty here, so we just take the list of the block.
 
-	list_type_sizes.reserve(max_type_size / step_size + 5); // 1...2...5... whatever
+	if (this->partial_blocks != nullptr) {
+		Block *block = this->partial_blocks;
+		this->unlink_partial_block(block);
 
-	for (size_t type_size = step_size; type_size < max_type_size; type_size += step_size)
-		list_type_sizes.push_back(type_size);
-	list_type_sizes.push_back(max_type_size);
-	
-	this->load(list_type_sizes, max_block_size);
+		this->free_chunks = block->free_chunks;
+		block->free_chunks = nullptr;
+		block->n_free_chunks = 0;
+	}
+	else if (!this->break_free_run()) // then the freed arrays
+		this->alloc_new_block();
 }
 
-PoolManager::~PoolManager ()
+size_t PoolCore::trim (const size_t max_chunks)
 {
-	for (PoolCore *allocator: this->allocators)
-		delete allocator;
+	size_t n = 0;
+
+	// the free runs are trimmed as single chunks, one run at a time
+
+	while (n < max_chunks && (this->free_chunks != nullptr || this->break_free_run())) {
+		Chunk *chunk = this->free_chunks;
+		this->free_chunks = chunk->next_chunk;
+		n++;
+
+		Block *block = this->find_block(chunk);
+
+		chunk->next_chunk = block->free_chunks;
+		block->free_chunks = chunk;
+
+		if (block->n_free_chunks++ == 0)
+			this->link_partial_block(block);
+
+		uint32_t n_unused = block->n_free_chunks;
+
+		if (block == this->untouched_block)
+			n_unused += (this->untouched_chunks_end - this->untouched_chunks) / this->chunk_size;
+
+		if (n_unused == block->n_chunks)
+			this->release_block(block);
+	}
+
+	return n;
 }
 
-void PoolManager::load (std::vector<size_t>& list_type_sizes, const size_t max_block_size)
+PoolCore::Block* PoolCore::find_block (const Chunk *chunk)
 {
-	// we remove values lower than the minimum
-	std::for_each(list_type_sizes.begin(), list_type_sizes.end(),
-		[] (size_t& v) -> void {
-			if (v < PoolCore::lowest_chunk_size())
-				v = PoolCore::lowest_chunk_size();
-		}
-	);
+	// the block of the chunk is the last one starting at or before the chunk
 
-	// we need the allocators to be sorted in order to create the index
-	std::sort(list_type_sizes.begin(), list_type_sizes.end(),
-		[] (const size_t a, const size_t b) -> bool {
-			return (a < b);
+	Block **it = std::upper_bound(this->blocks_index, this->blocks_index + this->n_blocks, chunk,
+		[] (const Chunk *chunk, const Block *block) -> bool {
+			return (chunk < block->chunks);
 		}
 	);
 
-	// let's also remove any duplicate entries
-	auto last = std::unique(list_type_sizes.begin(), list_type_sizes.end());
-	list_type_sizes.erase(last, list_type_sizes.end());
+	return *(it - 1);
+}
 
-	this->allocators.reserve( list_type_sizes.size() );
+void PoolCore::release_block (Block *block)
+{
+	this->unlink_partial_block(block);
 
-	for (const size_t type_size : list_type_sizes) {
-		const size_t chunks_per_block = max_block_size / type_size;
-		PoolCore *allocator = new PoolCore(type_size, chunks_per_block, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
-		this->allocators.push_back(allocator);
-	}
+	if (block->previous_block != nullptr)
+		block->previous_block->next_block = block->next_block;
+	else
+		this->blocks = block->next_block;
 
-	this->max_type_size = (*(this->allocators.end() - 1))->get_chunk_size();
+	if (block->next_block != nullptr)
+		block->next_block->previous_block = block->previous_block;
 
-#if 0
-	for (Core *allocator: this->allocators)
-		std::cout << "alloc size " << allocator->get_chunk_size() << std::endl;
-	std::cout << "max size is " << this->max_size << std::endl;
-#endif
+	Block **index_end = this->blocks_index + this->n_blocks;
+	Block **it = std::lower_bound(this->blocks_index, index_end, block,
+		[] (const Block *a, const Block *b) -> bool {
+			return (a->chunks < b->chunks);
+		}
+	);
+	std::move(it + 1, index_end, it);
 
-	// now, let's create an index for a O(1) time complexity
+	if (block == this->untouched_block) {
+		this->untouched_chunks = nullptr;
+		this->untouched_chunks_end = nullptr;
+		this->untouched_block = nullptr;
+	}
 
-	this->allocators_index.resize(this->max_type_size + 1, nullptr);
+	MYLIB_MEMORY_STATS_RUN( this->stats.block_bytes -= block->size; )
 
-	size_t type_size = 1;
-	for (PoolCore *allocator : this->allocators) {
-		while (type_size <= allocator->get_chunk_size()) {
-			this->allocators_index[type_size] = allocator;
-			type_size++;
-		}
-	}
+	this->free_block(block);
+	this->n_blocks--;
+}
 
-#if 0
-	for size_t i=0; i<this->allocators_index.size(); i++) {
-		size_t s = (this->allocators_index[i] == nullptr) ? 0 : this->allocators_index[i]->get_chunk_size();
-		std::cout << "index " << i << " size " << s << std::endl;
+void PoolCore::free_block (Block *block)
+{
+	if (this->block_policy.backend == BlockBackend::Segments) {
+		// the block header is inside the segment
+		segment_map.erase(block->memory, block->size);
+		free_block_memory(block->memory, block->size, this->align, this->block_policy);
+	}
+	else {
+		free_block_memory(block->memory, block->size, this->align, this->block_policy);
+		delete block;
 	}
-#endif
 }
 
-// ---------------------------------------------------
+void PoolCore::link_partial_block (Block *block)
+{
+	block->previous_partial_block = nullptr;
+	block->next_partial_block = this->partial_blocks;
 
-#if 0
+	if (this->partial_blocks != nullptr)
+		this->partial_blocks->previous_partial_block = block;
 
-datablock_general_alloc_t::datablock_general_alloc_t (size_t target_chunk_size)
+	this->partial_blocks = block;
+}
+
+void PoolCore::unlink_partial_block (Block *block)
 {
-	std::cout << "still under devepment!" << std::endl;
-	assert(0);
+	if (block->previous_partial_block != nullptr)
+		block->previous_partial_block->next_partial_block = block->next_partial_block;
+	else if (this->partial_blocks == block)
+		this->partial_blocks = block->next_partial_block;
 
-	this->target_chunk_size = target_chunk_size;
+	if (block->next_partial_block != nullptr)
+		block->next_partial_block->previous_partial_block = block->previous_partial_block;
 
-	this->chunks = nullptr;
-	this->free_chunks = nullptr;
+	block->previous_partial_block = nullptr;
+	block->next_partial_block = nullptr;
 }
 
-datablock_general_alloc_t::~datablock_general_alloc_t ()
+void PoolCore::retire_untouched_chunks ()
 {
-	Block *chunk, *next;
+	// When we need a new block while the current one still has untouched chunks
+	// (see allocate_contiguous), we move the remaining chunks to the free list,
+	// so they are not lost.
+
+	static_assert(sizeof(uint8_t) == 1);
 
-	for (chunk=this->chunks; chunk!=nullptr; chunk=next) {
-		next = chunk->next_chunk;
-		::operator delete(chunk->chunks);
-		delete chunk;
+	while (this->untouched_chunks != this->untouched_chunks_end) {
+		Chunk *chunk = reinterpret_cast<Chunk*>(this->untouched_chunks);
+		chunk->next_chunk = this->free_chunks;
+		this->free_chunks = chunk;
+		this->untouched_chunks += this->chunk_size;
 	}
 }
 
-void* datablock_general_alloc_t::alloc (size_t size)
+void* PoolCore::allocate_contiguous (const uint32_t count)
 {
-	Chunk *block;
+	if (count == 1)
+		return this->allocate();
 
-	if (this->free_chunks == nullptr) [[unlikely]]
-		block = this->alloc_new_chunk(size);
-	else {
-		block = this->find_free_block(size);
+	MYLIB_MEMORY_STATS_RUN( this->stats_allocated(1, count); )
 
-		if (block == nullptr)
-			block = this->alloc_new_chunk(size);
-	}
+	if (count > this->chunks_per_block) [[unlikely]]
+		return m_allocate(this->chunk_size * count, this->align);
+
+	void *p = this->pop_free_run(count);
+
+	if (p != nullptr)
+		return p;
 
-	Chunk *new_block = this->split_block(block, size);
-	new_block->status = block_status_t::occupied;
+	// The chunks in the free list are not necessarily contiguous,
+	// so we carve the run from the untouched chunks,
+	// allocating a fresh block if there isn't enough of them.
 
-	// +1 because payload data follows the block metadata
-	return static_cast<void*>(new_block + 1);
+	const size_t run_size = this->chunk_size * count;
+
+	if (static_cast<size_t>(this->untouched_chunks_end - this->untouched_chunks) < run_size)
+		this->alloc_new_block();
+
+	p = this->untouched_chunks;
+	this->untouched_chunks += run_size;
+
+	return p;
 }
 
-datablock_general_alloc_t::Chunk* datablock_general_alloc_t::alloc_new_chunk (size_t payload_size)
+void PoolCore::deallocate_contiguous (void *p, const uint32_t count)
 {
-	const size_t required_space = calculate_required_space(payload_size);
-	const size_t chunk_size = (required_space > this->target_chunk_size) ? required_space : this->target_chunk_size;
-
-	Block *new_chunk = new Block;
-	new_chunk->chunk_size = chunk_size;
-	new_chunk->chunks = static_cast<Chunk*>(::operator new(chunk_size));
-	new_chunk->next_chunk = this->chunks;
-	this->chunks = new_chunk;
+	if (count == 1) {
+		this->deallocate(p);
+		return;
+	}
 
-	// Since we just allocated a new chunk, this chunk has only one block initially.
-	// Therefore, we setup it's linked list accordingly.
+	MYLIB_MEMORY_STATS_RUN( this->stats_deallocated(1, count); )
 
-	Chunk *block = new_chunk->chunks;
-	block->chunk = new_chunk;
-	block->left = nullptr;
-	block->right = nullptr;
-	block->payload_capacity = calculate_payload_size(chunk_size);
-	block->status = block_status_t::free;
+	if (count > this->chunks_per_block) [[unlikely]] {
+		m_deallocate(p, this->chunk_size * count, this->align);
+		return;
+	}
 
-	// we also add the block to the free_chunks double-linked list
-	block->previous_free_block = nullptr;
-	block->next_free_block = this->free_chunks;
-	this->free_chunks = block;
+	// the run is kept whole, so the next array of the same length reuses it
 
-	return block;
+	this->push_free_run(p, count);
 }
 
-datablock_general_alloc_t::Chunk* datablock_general_alloc_t::find_free_block (size_t payload_size)
+void PoolCore::push_free_run (void *p, const uint32_t count)
 {
-	Chunk *target_block = nullptr;
+	Chunk *run = static_cast<Chunk*>(p);
 
-	for (Chunk *block=this->free_chunks; block!=nullptr; block=block->next_free_block) {
-		if (block->payload_capacity >= payload_size && block->status == block_status_t::free) {
-			target_block = block;
-			break;
-		}
+	if (count == 1) {
+		run->next_chunk = this->free_chunks;
+		this->free_chunks = run;
+		return;
 	}
 
-	return target_block;
+	if (this->free_runs.size() <= count)
+		this->free_runs.resize(count + 1, nullptr);
+
+	run->next_chunk = this->free_runs[count];
+	this->free_runs[count] = run;
+	this->n_free_runs++;
+	this->n_free_run_chunks += count;
 }
 
-datablock_general_alloc_t::Chunk* datablock_general_alloc_t::split_block (Chunk *block, size_t payload_size)
+void* PoolCore::pop_free_run (const uint32_t count)
 {
+	// not enough free chunks in the runs, even if all of them were merged
+	if (this->n_free_run_chunks < count)
+		return nullptr;
+
+	// Exact length first. Otherwise, we split the shortest longer run,
+	// and the remainder goes back to the list of its length.
+	// If there is no such run, we merge the adjacent runs and try again.
+
+	for (uint32_t attempt = 0; attempt < 2; attempt++) {
+		for (uint32_t n = count; n < this->free_runs.size(); n++) {
+			Chunk *run = this->free_runs[n];
+
+			if (run == nullptr)
+				continue;
+
+			this->free_runs[n] = run->next_chunk;
+			this->n_free_runs--;
+			this->n_free_run_chunks -= n;
+
+			if (n > count)
+				this->push_free_run(reinterpret_cast<uint8_t*>(run) + this->chunk_size * count, n - count);
+
+			return run;
+		}
+
+		if (attempt == 0)
+			this->coalesce_free_runs();
+	}
+
 	return nullptr;
 }
 
-void datablock_general_alloc_t::release (void *p)
+void PoolCore::coalesce_free_runs ()
 {
-	bool need_to_insert_in_free_list = true;
-	bool merged_left;
+	// The runs don't know their neighbours, so we sort all of them by address.
+	// Only called when no run is long enough, which is rare once
+	// the program reaches its steady state.
 
-	// -1 because payload data follows the block metadata
-	Chunk *block = static_cast<Chunk*>(p) - 1;
-	block->status = block_status_t::free;
+	struct Run {
+		uint8_t *begin;
+		uint32_t count;
+	};
 
-	// lets check if we can merge with the left block
-	if (block->left != nullptr && block->left->status == block_status_t::free) {
-		Chunk *block_left = block->left;
-		Chunk *block_right = block->right;
+	std::vector<Run> runs;
+	runs.reserve(this->n_free_runs);
 
-		block_left->payload_capacity += calculate_required_space(block->payload_capacity);
-		
-		block_left->right = block_right;
+	for (uint32_t n = 2; n < this->free_runs.size(); n++) {
+		for (Chunk *run = this->free_runs[n]; run != nullptr; run = run->next_chunk)
+			runs.push_back( Run { .begin = reinterpret_cast<uint8_t*>(run), .count = n } );
 
-		if (block_right != nullptr)
-			block_right->left = block_left;
-
-		block = block_left; // so we can check if we will also merge with the right block
-		need_to_insert_in_free_list = false; // since the left block is already in free_chunks list
-		merged_left = true;
+		this->free_runs[n] = nullptr;
 	}
-	else
-		merged_left = false;
-	
-	// lets check if we can merge with the right block
-	if (block->right != nullptr && block->right->status == block_status_t::free) {
-		Chunk *block_left = block->left;
-		Chunk *block_right = block->right;
-
-		// the merge must preserve th left block, since the
-		// block metadata must be in the beginning of the block storage
-
-
-	
-		need_to_insert_in_free_list = false; // since the left block is already in free_chunks list
-
-		// check if we are performing a double merge (with left and right)
-		// in this case, since both left and right were originally in the free_chunks list,
-		// we, need to remove the duplicate entry from free_chunks
-		// lets remove the right block then
-		if (merged_left) {
-			//Block *chunk = block->chunk;
-			Chunk *previous = block->right->previous_free_block;
-			Chunk *next = block->right->next_free_block;
-
-			
+
+	this->n_free_runs = 0;
+	this->n_free_run_chunks = 0;
+
+	std::sort(runs.begin(), runs.end(),
+		[] (const Run& a, const Run& b) -> bool {
+			return (a.begin < b.begin);
+		}
+	);
+
+	// Two blocks may be adjacent in memory (mmap), so a merged run may cross them.
+	// That's fine, since trim finds the block of each chunk separately.
+	// A merged run is never longer than chunks_per_block,
+	// since allocate_contiguous forwards longer arrays to m_allocate.
+
+	for (size_t i = 0; i < runs.size(); ) {
+		Run run = runs[i++];
+
+		while (i < runs.size() && runs[i].begin == (run.begin + this->chunk_size * run.count)
+			&& (run.count + runs[i].count) <= this->chunks_per_block) {
+			run.count += runs[i].count;
+			i++;
 		}
-		merged_left = true;
+
+		this->push_free_run(run.begin, run.count);
 	}
+}
+
+bool PoolCore::break_free_run ()
+{
+	// moves the chunks of a free run to the free list
+
+	if (this->n_free_runs == 0)
+		return false;
+
+	uint32_t count = this->free_runs.size() - 1;
+
+	while (this->free_runs[count] == nullptr)
+		count--;
 
-	if (need_to_insert_in_free_list) {
-		block->next_free_block = this->free_chunks;
-		block->previous_free_block = nullptr;
-		this->free_chunks = block;
+	Chunk *run = this->free_runs[count];
+	this->free_runs[count] = run->next_chunk;
+	this->n_free_runs--;
+	this->n_free_run_chunks -= count;
+
+	uint8_t *chunk = reinterpret_cast<uint8_t*>(run);
+
+	for (uint32_t i = 0; i < count; i++) {
+		Chunk *c = reinterpret_cast<Chunk*>(chunk);
+		c->next_chunk = this->free_chunks;
+		this->free_chunks = c;
+		chunk += this->chunk_size;
 	}
+
+	return true;
+}
+
+#ifdef MYLIB_MEMORY_STATS
+SizeClassStats PoolCore::get_size_class_stats () const
+{
+	SizeClassStats s = this->stats;
+	s.chunk_size = this->chunk_size;
+	s.n_blocks = this->n_blocks;
+	return s;
 }
 
+Stats PoolCore::get_stats () const
+{
+	Stats s;
+	SizeClassStats c = this->get_size_class_stats();
+
+	s.total = c.counters;
+	s.requested_bytes = c.requested_bytes;
+	s.n_allocated_blocks = c.n_allocated_blocks;
+	s.block_bytes = c.block_bytes;
+	s.size_classes.push_back(c);
+
+	return s;
+}
 #endif
 
 // ---------------------------------------------------
 
+// Ids of the ThreadCachedPoolCore still alive.
+// A finishing thread checks it before giving its caches back,
+// since the pools may have been destroyed before the thread.
+// Function-local so that it is constructed before (and destroyed after) any pool.
+
+struct LiveThreadCachedPools {
+	std::mutex mutex;
+	std::unordered_set<uint64_t> ids;
+};
+
+static LiveThreadCachedPools& live_thread_cached_pools ()
+{
+	static LiveThreadCachedPools pools;
+	return pools;
+}
+
+thread_local ThreadCachedPoolCore::ThreadCacheSlot ThreadCachedPoolCore::thread_cache_slots[ThreadCachedPoolCore::n_thread_cache_slots];
+thread_local ThreadCachedPoolCore::ThreadCacheBindings ThreadCachedPoolCore::thread_cache_bindings;
+std::atomic<uint64_t> ThreadCachedPoolCore::next_pool_id = 1;
+
+ThreadCachedPoolCore::ThreadCacheBindings::~ThreadCacheBindings ()
+{
+	LiveThreadCachedPools& live = live_thread_cached_pools();
+
+	// holding the lock, a pool can't be destroyed while we give it back its chunks
+	std::lock_guard<std::mutex> lock(live.mutex);
+
+	for (const ThreadCacheBinding& binding : this->list) {
+		if (live.ids.contains(binding.pool_id))
+			binding.pool->release_thread_cache(*binding.cache);
+	}
+
+	this->list.clear();
+
+	// the caches may be adopted by other threads now
+	for (ThreadCacheSlot& slot : thread_cache_slots)
+		slot = ThreadCacheSlot();
+}
+
+ThreadCachedPoolCore::ThreadCachedPoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_, const uint32_t batch_size_)
+	: pool_id(next_pool_id.fetch_add(1, std::memory_order_relaxed)),
+	  header_size(round_up_size(sizeof(Chunk), align_)),
+	  batch_size(batch_size_),
+	  type_size(type_size_),
+	  // payload must be a multiple of align so that all the chunks in the block keep the alignment
+	  central(this->header_size + round_up_size(type_size_, align_), chunks_per_block_, align_)
+{
+	LiveThreadCachedPools& live = live_thread_cached_pools();
+	std::lock_guard<std::mutex> lock(live.mutex);
+	live.ids.insert(this->pool_id);
+}
+
+ThreadCachedPoolCore::~ThreadCachedPoolCore ()
+{
+	{
+		// from now on, finishing threads leave the pool alone
+		LiveThreadCachedPools& live = live_thread_cached_pools();
+		std::lock_guard<std::mutex> lock(live.mutex);
+		live.ids.erase(this->pool_id);
+	}
+
+	// The chunks are all stored in the blocks of the central pool,
+	// which are released by its destructor.
+	for (ThreadCache *cache : this->caches)
+		delete cache;
+}
+
+uint32_t ThreadCachedPoolCore::get_n_blocks ()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->central.get_n_blocks();
+}
+
+uint32_t ThreadCachedPoolCore::get_n_thread_caches ()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return static_cast<uint32_t>(this->caches.size());
+}
+
+ThreadCachedPoolCore::ThreadCache& ThreadCachedPoolCore::bind_thread_cache (ThreadCacheSlot& slot)
+{
+	std::vector<ThreadCacheBinding>& bindings = thread_cache_bindings.list;
+	ThreadCache *cache = nullptr;
+
+	// The slot may just have been taken by another pool.
+	// In this case, the thread already has a cache for us.
+
+	for (const ThreadCacheBinding& binding : bindings) {
+		if (binding.pool_id == this->pool_id) {
+			cache = binding.cache;
+			break;
+		}
+	}
+
+	if (cache == nullptr) {
+		// First time this thread uses the pool.
+		// We take the chance to forget the pools already destroyed,
+		// so the bindings of a long-lived thread don't grow forever.
+
+		{
+			LiveThreadCachedPools& live = live_thread_cached_pools();
+			std::lock_guard<std::mutex> lock(live.mutex);
+
+			std::erase_if(bindings, [&live] (const ThreadCacheBinding& binding) {
+				return !live.ids.contains(binding.pool_id);
+			});
+		}
+
+		// reserve before taking the cache, so push_back can't throw and lose it
+		bindings.reserve(bindings.size() + 1);
+
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+
+			if (!this->orphan_caches.empty()) {
+				cache = this->orphan_caches.back();
+				this->orphan_caches.pop_back();
+			}
+			else {
+				// release_thread_cache runs at thread exit and must not throw,
+				// so there is always room for all the caches in orphan_caches
+				this->caches.reserve(this->caches.size() + 1);
+				this->orphan_caches.reserve(this->caches.size() + 1);
+				cache = new ThreadCache;
+				this->caches.push_back(cache);
+			}
+		}
+
+		bindings.push_back(ThreadCacheBinding { this->pool_id, this, cache });
+	}
+
+	slot.pool_id = this->pool_id;
+	slot.cache = cache;
+
+	return *cache;
+}
+
+void ThreadCachedPoolCore::release_thread_cache (ThreadCache& cache)
+{
+	// The thread that owned the cache is finishing.
+	// Its chunks go back to the shared pool, but the cache is kept,
+	// since chunks still in use point to it.
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	while (cache.local_chunks != nullptr) {
+		Chunk *chunk = cache.local_chunks;
+		cache.local_chunks = chunk->next_chunk;
+		this->central.deallocate(chunk);
+	}
+
+	cache.n_local_chunks = 0;
+
+	this->release_remote_chunks(cache);
+	this->orphan_caches.push_back(&cache);
+}
+
+void ThreadCachedPoolCore::release_remote_chunks (ThreadCache& cache)
+{
+	// mutex must be locked
+
+	Chunk *chunk = cache.remote_chunks.exchange(nullptr, std::memory_order_acquire);
+
+	while (chunk != nullptr) {
+		Chunk *next = chunk->next_chunk;
+		this->central.deallocate(chunk);
+		chunk = next;
+	}
+}
+
+void ThreadCachedPoolCore::refill (ThreadCache& cache)
+{
+	// first, we try to get back the chunks freed by other threads
+
+	Chunk *remote = cache.remote_chunks.exchange(nullptr, std::memory_order_acquire);
+
+	if (remote != nullptr) {
+		uint32_t n = 1;
+		Chunk *last = remote;
+
+		while (last->next_chunk != nullptr) {
+			last = last->next_chunk;
+			n++;
+		}
+
+		last->next_chunk = cache.local_chunks;
+		cache.local_chunks = remote;
+		cache.n_local_chunks += n;
+
+		return;
+	}
+
+	// no remote chunks, so we get a batch from the shared pool
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	// chunks freed to the caches of finished threads would be stranded otherwise
+	for (ThreadCache *orphan : this->orphan_caches)
+		this->release_remote_chunks(*orphan);
+
+	for (uint32_t i = 0; i < this->batch_size; i++) {
+		Chunk *chunk = static_cast<Chunk*>( this->central.allocate() );
+		chunk->next_chunk = cache.local_chunks;
+		cache.local_chunks = chunk;
+	}
+
+	cache.n_local_chunks += this->batch_size;
+}
+
+void ThreadCachedPoolCore::flush (ThreadCache& cache)
+{
+	// we give back a batch of chunks to the shared pool,
+	// so a thread that only frees doesn't keep all the memory
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+
+	for (uint32_t i = 0; i < this->batch_size; i++) {
+		Chunk *chunk = cache.local_chunks;
+		cache.local_chunks = chunk->next_chunk;
+		this->central.deallocate(chunk);
+	}
+
+	cache.n_local_chunks -= this->batch_size;
+}
+
+// ---------------------------------------------------
+
+ConcurrentPoolCore::ConcurrentPoolCore (const size_t type_size_, const uint32_t chunks_per_block_, const size_t align_)
+	: type_size(type_size_), chunks_per_block(chunks_per_block_), align(align_),
+	  chunk_size(round_up_size((type_size_ < lowest_chunk_size()) ? lowest_chunk_size() : type_size_, align_))
+{
+}
+
+ConcurrentPoolCore::~ConcurrentPoolCore ()
+{
+	Block *block, *next;
+
+	for (block = this->blocks; block != nullptr; block = next) {
+		next = block->next_block;
+		m_deallocate(block->chunks, this->chunk_size * this->chunks_per_block, this->align);
+		delete block;
+	}
+}
+
+void ConcurrentPoolCore::alloc_new_block ()
+{
+	// Only one thread allocates a block at a time.
+	// If another thread already did while we were waiting for the lock,
+	// there is no need to allocate another one.
+
+	std::lock_guard<std::mutex> lock(this->block_mutex);
+
+	if (untag_pointer(this->free_chunks.load(std::memory_order_acquire)) != nullptr)
+		return;
+
+	const size_t block_size = this->chunk_size * this->chunks_per_block;
+	Chunk *chunks = static_cast<Chunk*>( m_allocate(block_size, this->align) );
+
+	// the chunks are packed with the tag in 64 bits (see tag_pointer)
+
+	const uint64_t last_byte = reinterpret_cast<uint64_t>(chunks) + block_size - 1;
+
+	if ((last_byte & ~pointer_mask) != 0) [[unlikely]] {
+		m_deallocate(chunks, block_size, this->align);
+		mylib_throw_assert_msg("ConcurrentPoolCore requires ", pointer_bits, "-bit addresses, but got block ", static_cast<void*>(chunks));
+	}
+
+	Block *new_block = new Block;
+
+	new_block->chunks = chunks;
+	new_block->next_block = this->blocks;
+	this->blocks = new_block;
+
+	// The block is still private to this thread,
+	// so we can build its free list without atomics.
+
+	Chunk *chunk = new_block->chunks;
+
+	for (uint32_t i = 0; i < this->chunks_per_block-1; i++) {
+		chunk->next_chunk = reinterpret_cast<Chunk*>( reinterpret_cast<uint8_t*>(chunk) + this->chunk_size );
+		chunk = chunk->next_chunk;
+	}
+
+	// Now, we splice the whole list into free_chunks with a single CAS.
+
+	Chunk *last = chunk;
+	uint64_t head = this->free_chunks.load(std::memory_order_relaxed);
+
+	do {
+		last->next_chunk = untag_pointer(head);
+	} while (!this->free_chunks.compare_exchange_weak(head, tag_pointer(new_block->chunks, head), std::memory_order_release, std::memory_order_relaxed));
+}
+
+// ---------------------------------------------------
+
+std::vector<size_t> SizeProfile::build_size_classes (const uint32_t n_classes, const size_t max_type_size, const size_t granularity) const
+{
+	mylib_assert_msg(n_classes > 0, "at least one size class is required")
+
+	// Each recorded size is first rounded up to the granularity.
+	// Sizes that end up equal are merged in a single bucket.
+
+	struct Bucket {
+		size_t size;
+		uint64_t count;
+		uint64_t bytes; // sum of the requested sizes
+	};
+
+	std::vector<Bucket> buckets;
+
+	for (const auto& [type_size, count] : this->histogram) {
+		if (type_size > max_type_size)
+			break;
+
+		const size_t size = round_up_size((type_size == 0) ? 1 : type_size, granularity);
+
+		if (buckets.empty() || buckets.back().size != size)
+			buckets.push_back(Bucket { .size = size, .count = 0, .bytes = 0 });
+
+		buckets.back().count += count;
+		buckets.back().bytes += count * type_size;
+	}
+
+	std::vector<size_t> list_type_sizes;
+
+	if (buckets.empty()) {
+		list_type_sizes.push_back(round_up_size(max_type_size, granularity));
+		return list_type_sizes;
+	}
+
+	if (buckets.size() <= n_classes) {
+		for (const Bucket& bucket : buckets)
+			list_type_sizes.push_back(bucket.size);
+		return list_type_sizes;
+	}
+
+	/*
+		Dynamic programming, O(n_classes * n_buckets^2).
+		A size class always ends at a bucket, so we have to partition
+		the buckets in n_classes consecutive groups.
+		The waste of a group (i..j] is size[j] * count(i..j] - bytes(i..j].
+		waste[k][j] is the minimum waste of the first j buckets using k classes.
+	*/
+
+	const size_t n_buckets = buckets.size();
+
+	std::vector<uint64_t> prefix_count(n_buckets + 1, 0);
+	std::vector<uint64_t> prefix_bytes(n_buckets + 1, 0);
+
+	for (size_t j = 0; j < n_buckets; j++) {
+		prefix_count[j + 1] = prefix_count[j] + buckets[j].count;
+		prefix_bytes[j + 1] = prefix_bytes[j] + buckets[j].bytes;
+	}
+
+	auto group_waste = [&] (const size_t i, const size_t j) -> uint64_t {
+		return buckets[j - 1].size * (prefix_count[j] - prefix_count[i]) - (prefix_bytes[j] - prefix_bytes[i]);
+	};
+
+	constexpr uint64_t infinite = std::numeric_limits<uint64_t>::max();
+
+	std::vector<uint64_t> waste((n_classes + 1) * (n_buckets + 1), infinite);
+	std::vector<uint32_t> split((n_classes + 1) * (n_buckets + 1), 0);
+
+	auto at = [n_buckets] (const size_t k, const size_t j) -> size_t {
+		return k * (n_buckets + 1) + j;
+	};
+
+	waste[at(0, 0)] = 0;
+
+	for (size_t k = 1; k <= n_classes; k++) {
+		for (size_t j = k; j <= n_buckets; j++) {
+			for (size_t i = k - 1; i < j; i++) {
+				if (waste[at(k - 1, i)] == infinite)
+					continue;
+
+				const uint64_t w = waste[at(k - 1, i)] + group_waste(i, j);
+
+				if (w < waste[at(k, j)]) {
+					waste[at(k, j)] = w;
+					split[at(k, j)] = static_cast<uint32_t>(i);
+				}
+			}
+		}
+	}
+
+	// now, we walk back the splits to get the classes
+
+	list_type_sizes.resize(n_classes);
+
+	size_t j = n_buckets;
+
+	for (size_t k = n_classes; k > 0; k--) {
+		list_type_sizes[k - 1] = buckets[j - 1].size;
+		j = split[at(k, j)];
+	}
+
+	return list_type_sizes;
+}
+
+void SizeProfile::dump_histogram (std::ostream& out) const
+{
+	for (const auto& [type_size, count] : this->histogram)
+		out << type_size << " " << count << std::endl;
+}
+
+void SizeProfile::dump_size_class_table (std::ostream& out, const char *name, const std::vector<size_t>& size_classes)
+{
+	out << "using " << name << " = Mylib::Memory::SizeClassTable<";
+
+	for (size_t i = 0; i < size_classes.size(); i++) {
+		if (i > 0)
+			out << ", ";
+		out << size_classes[i];
+	}
+
+	out << ">;" << std::endl;
+}
+
+// ---------------------------------------------------
+
+static std::vector<size_t> build_type_sizes (const size_t max_type_size, const size_t step_size)
+{
+	std::vector<size_t> list_type_sizes;
+
+	list_type_sizes.reserve(max_type_size / step_size + 5); // 1...2...5... whatever
+
+	for (size_t type_size = step_size; type_size < max_type_size; type_size += step_size)
+		list_type_sizes.push_back(type_size);
+	list_type_sizes.push_back(max_type_size);
+
+	return list_type_sizes;
+}
+
+static void normalize_type_sizes (std::vector<size_t>& list_type_sizes, const size_t lowest_chunk_size)
+{
+	// we remove values lower than the minimum
+	std::for_each(list_type_sizes.begin(), list_type_sizes.end(),
+		[lowest_chunk_size] (size_t& v) -> void {
+			if (v < lowest_chunk_size)
+				v = lowest_chunk_size;
+		}
+	);
+
+	// we need the allocators to be sorted in order to create the index
+	std::sort(list_type_sizes.begin(), list_type_sizes.end(),
+		[] (const size_t a, const size_t b) -> bool {
+			return (a < b);
+		}
+	);
+
+	// let's also remove any duplicate entries
+	auto last = std::unique(list_type_sizes.begin(), list_type_sizes.end());
+	list_type_sizes.erase(last, list_type_sizes.end());
+}
+
+template <typename Tcore>
+static void build_allocators_index (const std::vector<Tcore*>& allocators, std::vector<Tcore*>& allocators_index, const size_t max_type_size)
+{
+	// now, let's create an index for a O(1) time complexity
+
+	allocators_index.resize(max_type_size + 1, nullptr);
+
+	size_t type_size = 1;
+	for (Tcore *allocator : allocators) {
+		while (type_size <= allocator->get_chunk_size()) {
+			allocators_index[type_size] = allocator;
+			type_size++;
+		}
+	}
+}
+
+static size_t natural_alignment (const size_t size) noexcept
+{
+	// largest power of two that divides size
+	const size_t align = size & (~size + 1);
+
+	return (align != 0 && align < __STDCPP_DEFAULT_NEW_ALIGNMENT__) ? align : __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+}
+
+static std::vector<SizeClass> build_natural_size_classes (const std::span<const size_t> list_type_sizes)
+{
+	std::vector<SizeClass> size_classes;
+
+	size_classes.reserve(list_type_sizes.size());
+
+	for (const size_t size : list_type_sizes)
+		size_classes.push_back(SizeClass { .size = size, .align = natural_alignment(size) });
+
+	return size_classes;
+}
+
+static void normalize_size_classes (std::vector<SizeClass>& size_classes, const size_t lowest_chunk_size)
+{
+	// The sizes are the ones the index uses, the pools pad their chunks to the alignment.
+	for (SizeClass& size_class : size_classes) {
+		mylib_assert_msg(std::has_single_bit(size_class.align), "alignment ", size_class.align, " is not a power of two")
+
+		if (size_class.size < lowest_chunk_size)
+			size_class.size = lowest_chunk_size;
+	}
+
+	// When two classes have the same size, we keep the one with the greatest alignment,
+	// since its chunks are also aligned to the other one.
+	std::sort(size_classes.begin(), size_classes.end(),
+		[] (const SizeClass& a, const SizeClass& b) -> bool {
+			return (a.size < b.size) || (a.size == b.size && a.align > b.align);
+		}
+	);
+
+	auto last = std::unique(size_classes.begin(), size_classes.end(),
+		[] (const SizeClass& a, const SizeClass& b) -> bool {
+			return (a.size == b.size);
+		}
+	);
+	size_classes.erase(last, size_classes.end());
+}
+
+// ---------------------------------------------------
+
+PoolManager::PoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<SizeClass> v = build_natural_size_classes(list_type_sizes);
+	this->load(v, max_block_size, block_policy);
+}
+
+PoolManager::PoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<SizeClass> v = build_natural_size_classes(std::span<const size_t>(list_type_sizes.begin(), list_type_sizes.size()));
+	this->load(v, max_block_size, block_policy);
+}
+
+PoolManager::PoolManager (const std::span<const SizeClass> size_classes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<SizeClass> v(size_classes.begin(), size_classes.end());
+	this->load(v, max_block_size, block_policy);
+}
+
+PoolManager::PoolManager (std::initializer_list<SizeClass> size_classes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<SizeClass> v(size_classes);
+	this->load(v, max_block_size, block_policy);
+}
+
+PoolManager::PoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<SizeClass> size_classes = build_natural_size_classes(build_type_sizes(max_type_size, step_size));
+	this->load(size_classes, max_block_size, block_policy);
+}
+
+PoolManager::~PoolManager ()
+{
+	for (PoolCore *allocator: this->allocators)
+		delete allocator;
+}
+
+PoolManager::PoolManager (const SizeProfile& profile, const uint32_t n_classes, const size_t max_type_size, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	std::vector<size_t> list_type_sizes = profile.build_size_classes(n_classes, max_type_size);
+
+	// sizes above the largest recorded one must still go to the pools
+	const size_t last_size = round_up_size(max_type_size, PoolCore::lowest_chunk_size());
+
+	if (list_type_sizes.back() < last_size)
+		list_type_sizes.push_back(last_size);
+
+	std::vector<SizeClass> size_classes = build_natural_size_classes(list_type_sizes);
+	this->load(size_classes, max_block_size, block_policy);
+}
+
+void PoolManager::load (std::vector<SizeClass>& size_classes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	normalize_size_classes(size_classes, PoolCore::lowest_chunk_size());
+
+	this->create_allocators(size_classes, max_block_size, block_policy);
+
+	// now, let's create an index for a O(1) time complexity
+
+	this->allocators_index_storage.resize(this->max_type_size + 1, 0);
+
+	uint16_t c = 0;
+	for (size_t type_size = 1; type_size <= this->max_type_size; type_size++) {
+		if (type_size > size_classes[c].size)
+			c++;
+		this->allocators_index_storage[type_size] = c;
+	}
+
+	this->allocators_index = this->allocators_index_storage;
+
+#if 0
+	for (size_t i=0; i<this->allocators_index.size(); i++)
+		std::cout << "index " << i << " size " << this->allocators[ this->allocators_index[i] ]->get_chunk_size() << std::endl;
+#endif
+}
+
+void PoolManager::create_allocators (const std::span<const size_t> list_type_sizes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	const std::vector<SizeClass> size_classes = build_natural_size_classes(list_type_sizes);
+	this->create_allocators(size_classes, max_block_size, block_policy);
+}
+
+void PoolManager::create_allocators (const std::span<const SizeClass> size_classes, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	mylib_assert_msg(size_classes.size() <= std::numeric_limits<uint16_t>::max(), "PoolManager supports up to ", std::numeric_limits<uint16_t>::max(), " size classes")
+
+	this->allocators.reserve( size_classes.size() );
+	this->block_backend = block_policy.backend;
+
+	for (const SizeClass& size_class : size_classes) {
+		const size_t chunks_per_block = max_block_size / size_class.size;
+		PoolCore *allocator = new PoolCore(size_class.size, chunks_per_block, size_class.align, block_policy);
+		this->allocators.push_back(allocator);
+	}
+
+	this->max_type_size = size_classes.back().size;
+
+#if 0
+	for (PoolCore *allocator: this->allocators)
+		std::cout << "alloc size " << allocator->get_chunk_size() << std::endl;
+	std::cout << "max size is " << this->max_type_size << std::endl;
+#endif
+}
+
+PoolCore* PoolManager::find_contiguous_allocator (const size_t type_size, const size_t count, uint32_t& n_chunks)
+{
+	// Small arrays fit in a single chunk of a larger size class.
+
+	const size_t total_size = type_size * count;
+
+	if (total_size <= this->max_type_size) {
+		n_chunks = 1;
+		return this->get_allocator(total_size);
+	}
+
+	// Otherwise, we carve a run of contiguous chunks from the size class of the type.
+
+	if (type_size <= this->max_type_size) {
+		PoolCore *allocator = this->get_allocator(type_size);
+		const size_t chunk_size = allocator->get_chunk_size();
+		const size_t n = (total_size + chunk_size - 1) / chunk_size;
+
+		if (n <= allocator->get_chunks_per_block()) {
+			n_chunks = static_cast<uint32_t>(n);
+			return allocator;
+		}
+	}
+
+	return nullptr;
+}
+
+void* PoolManager::allocate_multi (const size_t type_size, const size_t count, const size_t align)
+{
+	uint32_t n_chunks;
+	PoolCore *allocator = this->find_contiguous_allocator(type_size, count, n_chunks);
+
+	if (allocator != nullptr) {
+		MYLIB_MEMORY_STATS_RUN( this->stats_pool_allocated(allocator, type_size * count, n_chunks, 1); )
+		return allocator->allocate_contiguous(n_chunks);
+	}
+
+	MYLIB_MEMORY_STATS_RUN( this->stats_fallback_allocated(type_size * count); )
+
+	if (this->large_manager != nullptr)
+		return this->large_manager->allocate(type_size, count, align);
+	else
+		return m_allocate(type_size * count, align);
+}
+
+void PoolManager::deallocate_multi (void *p, const size_t type_size, const size_t count, const size_t align)
+{
+	uint32_t n_chunks;
+	PoolCore *allocator = this->find_contiguous_allocator(type_size, count, n_chunks);
+
+	if (allocator != nullptr) {
+		allocator->deallocate_contiguous(p, n_chunks);
+		MYLIB_MEMORY_STATS_RUN( this->stats_pool_deallocated(allocator, type_size * count, n_chunks, 1); )
+		return;
+	}
+
+	MYLIB_MEMORY_STATS_RUN( this->stats_fallback_deallocated(type_size * count); )
+
+	if (this->large_manager != nullptr)
+		this->large_manager->deallocate(p, type_size, count, align);
+	else
+		m_deallocate(p, type_size * count, align);
+}
+
+size_t PoolManager::trim (const size_t max_chunks)
+{
+	// We continue from the size class where the last call stopped.
+
+	size_t n = 0;
+
+	for (size_t i = 0; i < this->allocators.size(); i++) {
+		const size_t budget = max_chunks - n;
+
+		n += this->allocators[this->trim_cursor]->trim(budget);
+
+		if (n == max_chunks)
+			break;
+
+		this->trim_cursor = (this->trim_cursor + 1) % this->allocators.size();
+	}
+
+	return n;
+}
+
+#ifdef MYLIB_MEMORY_STATS
+Stats PoolManager::get_stats () const
+{
+	Stats s;
+
+	s.total = this->stats_total;
+	s.fallback = this->stats_fallback;
+	s.requested_bytes = this->stats_fallback.current_bytes;
+
+	for (const PoolCore *allocator : this->allocators) {
+		SizeClassStats c = allocator->get_size_class_stats();
+
+		s.requested_bytes += c.requested_bytes;
+		s.n_allocated_blocks += c.n_allocated_blocks;
+		s.block_bytes += c.block_bytes;
+		s.size_classes.push_back(c);
+	}
+
+	return s;
+}
+#endif
+
+// ---------------------------------------------------
+
+NumaPoolManager::NumaPoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size, const BlockPolicy& block_policy)
+{
+	const uint32_t n_nodes = get_numa_n_nodes();
+
+	for (uint32_t i = 0; i < n_nodes; i++) {
+		BlockPolicy node_policy = block_policy;
+		node_policy.backend = BlockBackend::Segments;
+		node_policy.numa = (n_nodes > 1) ? NumaBinding::Node : NumaBinding::None;
+		node_policy.numa_node = i;
+
+		auto node = std::make_unique<Node>();
+		node->manager = std::make_unique<PoolManager>(max_type_size, step_size, max_block_size, node_policy);
+
+		for (const PoolCore *pool : node->manager->get_pools())
+			this->pool_nodes[pool] = i;
+
+		this->nodes.push_back(std::move(node));
+	}
+}
+
+size_t NumaPoolManager::trim (const size_t max_chunks)
+{
+	size_t n = 0;
+
+	for (auto& node : this->nodes) {
+		std::scoped_lock lock(node->mutex);
+		n += node->manager->trim(max_chunks);
+	}
+
+	return n;
+}
+
+// ---------------------------------------------------
+
+ConcurrentPoolManager::ConcurrentPoolManager (const std::span<size_t> list_type_sizes, const size_t max_block_size)
+{
+	std::vector<size_t> v(list_type_sizes.begin(), list_type_sizes.end());
+	this->load(v, max_block_size);
+}
+
+ConcurrentPoolManager::ConcurrentPoolManager (std::initializer_list<size_t> list_type_sizes, const size_t max_block_size)
+{
+	std::vector<size_t> v(list_type_sizes);
+	this->load(v, max_block_size);
+}
+
+ConcurrentPoolManager::ConcurrentPoolManager (const size_t max_type_size, const size_t step_size, const size_t max_block_size)
+{
+	std::vector<size_t> list_type_sizes = build_type_sizes(max_type_size, step_size);
+	this->load(list_type_sizes, max_block_size);
+}
+
+ConcurrentPoolManager::~ConcurrentPoolManager ()
+{
+	for (ConcurrentPoolCore *allocator: this->allocators)
+		delete allocator;
+}
+
+void ConcurrentPoolManager::load (std::vector<size_t>& list_type_sizes, const size_t max_block_size)
+{
+	normalize_type_sizes(list_type_sizes, ConcurrentPoolCore::lowest_chunk_size());
+
+	this->allocators.reserve( list_type_sizes.size() );
+
+	for (const size_t type_size : list_type_sizes) {
+		const size_t chunks_per_block = max_block_size / type_size;
+		ConcurrentPoolCore *allocator = new ConcurrentPoolCore(type_size, chunks_per_block, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		this->allocators.push_back(allocator);
+	}
+
+	this->max_type_size = (*(this->allocators.end() - 1))->get_chunk_size();
+
+	build_allocators_index(this->allocators, this->allocators_index, this->max_type_size);
+}
+
+// ---------------------------------------------------
+
+GeneralManager::GeneralManager (const size_t target_block_size_)
+	: target_block_size(round_up_size(target_block_size_, alignment))
+{
+}
+
+GeneralManager::~GeneralManager ()
+{
+	Block *block, *next;
+
+	for (block = this->blocks; block != nullptr; block = next) {
+		next = block->next_block;
+		m_deallocate(block, block->size, alignment);
+	}
+}
+
+void* GeneralManager::allocate_chunk (const size_t size)
+{
+	const size_t payload_size = round_up_size((size < min_payload) ? min_payload : size, alignment);
+
+	Chunk *chunk = this->find_free_chunk(payload_size);
+
+	if (chunk == nullptr) [[unlikely]]
+		chunk = this->alloc_new_block(payload_size);
+	else
+		this->remove_free_chunk(chunk);
+
+	this->split_chunk(chunk, payload_size);
+	chunk->status = ChunkStatus::Occupied;
+
+	// +1 because payload data follows the chunk metadata
+	return static_cast<void*>(chunk + 1);
+}
+
+void GeneralManager::deallocate_chunk (void *p)
+{
+	// -1 because payload data follows the chunk metadata
+	Chunk *chunk = static_cast<Chunk*>(p) - 1;
+	chunk->status = ChunkStatus::Free;
+
+	// lets check if we can merge with the left chunk
+	// the merge must preserve the left chunk, since the
+	// chunk metadata must be in the beginning of the chunk storage
+	if (chunk->left != nullptr && chunk->left->status == ChunkStatus::Free) {
+		Chunk *chunk_left = chunk->left;
+
+		this->remove_free_chunk(chunk_left);
+
+		chunk_left->payload_capacity += calculate_required_space(chunk->payload_capacity);
+		chunk_left->right = chunk->right;
+
+		if (chunk->right != nullptr)
+			chunk->right->left = chunk_left;
+
+		chunk = chunk_left; // so we can check if we will also merge with the right chunk
+	}
+
+	// lets check if we can merge with the right chunk
+	if (chunk->right != nullptr && chunk->right->status == ChunkStatus::Free) {
+		Chunk *chunk_right = chunk->right;
+
+		this->remove_free_chunk(chunk_right);
+
+		chunk->payload_capacity += calculate_required_space(chunk_right->payload_capacity);
+		chunk->right = chunk_right->right;
+
+		if (chunk_right->right != nullptr)
+			chunk_right->right->left = chunk;
+	}
+
+	// Blocks larger than the target size were allocated for a single large request.
+	// When they get empty, we give them back.
+	if (chunk->left == nullptr && chunk->right == nullptr) {
+		Block *block = reinterpret_cast<Block*>(chunk) - 1;
+
+		if (block->size > this->target_block_size) {
+			this->release_block(block);
+			return;
+		}
+	}
+
+	this->insert_free_chunk(chunk);
+}
+
+GeneralManager::Chunk* GeneralManager::alloc_new_block (const size_t payload_size)
+{
+	const size_t required_space = sizeof(Block) + calculate_required_space(payload_size);
+	const size_t block_size = (required_space > this->target_block_size) ? required_space : this->target_block_size;
+
+	Block *block = static_cast<Block*>( m_allocate(block_size, alignment) );
+	block->size = block_size;
+	block->previous_block = nullptr;
+	block->next_block = this->blocks;
+
+	if (this->blocks != nullptr)
+		this->blocks->previous_block = block;
+	this->blocks = block;
+
+	// Since we just allocated a new block, this block has only one chunk initially.
+	// Therefore, we setup it's linked list accordingly.
+	// The chunk is not inserted in the free lists, since it is going to be used right away.
+
+	Chunk *chunk = reinterpret_cast<Chunk*>(block + 1);
+	chunk->left = nullptr;
+	chunk->right = nullptr;
+	chunk->payload_capacity = calculate_payload_size(block_size - sizeof(Block));
+	chunk->status = ChunkStatus::Free;
+
+	return chunk;
+}
+
+void GeneralManager::release_block (Block *block)
+{
+	if (block->previous_block != nullptr)
+		block->previous_block->next_block = block->next_block;
+	else
+		this->blocks = block->next_block;
+
+	if (block->next_block != nullptr)
+		block->next_block->previous_block = block->previous_block;
+
+	m_deallocate(block, block->size, alignment);
+}
+
+GeneralManager::Chunk* GeneralManager::find_free_chunk (const size_t payload_size)
+{
+	// We round up the size to the next size class,
+	// so any chunk of the class we find is large enough.
+
+	size_t size = payload_size;
+
+	if (size >= small_size)
+		size += (static_cast<size_t>(1) << (std::bit_width(size) - 1 - second_level_log2)) - 1;
+
+	uint32_t first_level, second_level;
+	mapping_insert(size, first_level, second_level);
+
+	if (first_level >= n_first_level) [[unlikely]]
+		return nullptr;
+
+	// first, we look in the same first level
+	uint32_t second_level_map = this->second_level_bitmap[first_level] & (~static_cast<uint32_t>(0) << second_level);
+
+	if (second_level_map == 0) {
+		// then, we look in the larger first levels
+		const uint64_t first_level_map = (first_level + 1 < 64)
+			? (this->first_level_bitmap & (~static_cast<uint64_t>(0) << (first_level + 1)))
+			: 0;
+
+		if (first_level_map == 0)
+			return nullptr;
+
+		first_level = std::countr_zero(first_level_map);
+		second_level_map = this->second_level_bitmap[first_level];
+	}
+
+	second_level = std::countr_zero(second_level_map);
+
+	return this->free_chunks[first_level][second_level];
+}
+
+void GeneralManager::split_chunk (Chunk *chunk, const size_t payload_size)
+{
+	// we only split if the remaining space is enough for a new chunk
+
+	if (chunk->payload_capacity < (calculate_required_space(payload_size) + min_payload))
+		return;
+
+	Chunk *new_chunk = reinterpret_cast<Chunk*>( reinterpret_cast<uint8_t*>(chunk + 1) + payload_size );
+	new_chunk->payload_capacity = chunk->payload_capacity - calculate_required_space(payload_size);
+	new_chunk->status = ChunkStatus::Free;
+	new_chunk->left = chunk;
+	new_chunk->right = chunk->right;
+
+	if (chunk->right != nullptr)
+		chunk->right->left = new_chunk;
+
+	chunk->right = new_chunk;
+	chunk->payload_capacity = payload_size;
+
+	this->insert_free_chunk(new_chunk);
+}
+
+void GeneralManager::insert_free_chunk (Chunk *chunk)
+{
+	uint32_t first_level, second_level;
+	mapping_insert(chunk->payload_capacity, first_level, second_level);
+
+	Chunk *head = this->free_chunks[first_level][second_level];
+
+	chunk->previous_free_chunk = nullptr;
+	chunk->next_free_chunk = head;
+
+	if (head != nullptr)
+		head->previous_free_chunk = chunk;
+
+	this->free_chunks[first_level][second_level] = chunk;
+	this->first_level_bitmap |= static_cast<uint64_t>(1) << first_level;
+	this->second_level_bitmap[first_level] |= static_cast<uint32_t>(1) << second_level;
+}
+
+void GeneralManager::remove_free_chunk (Chunk *chunk)
+{
+	uint32_t first_level, second_level;
+	mapping_insert(chunk->payload_capacity, first_level, second_level);
+
+	Chunk *previous = chunk->previous_free_chunk;
+	Chunk *next = chunk->next_free_chunk;
+
+	if (next != nullptr)
+		next->previous_free_chunk = previous;
+
+	if (previous != nullptr)
+		previous->next_free_chunk = next;
+	else {
+		this->free_chunks[first_level][second_level] = next;
+
+		if (next == nullptr) {
+			this->second_level_bitmap[first_level] &= ~(static_cast<uint32_t>(1) << second_level);
+
+			if (this->second_level_bitmap[first_level] == 0)
+				this->first_level_bitmap &= ~(static_cast<uint64_t>(1) << first_level);
+		}
+	}
+}
+
+// ---------------------------------------------------
+
 } // end namespace Memory
 } // end namespace Mylib
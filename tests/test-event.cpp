@@ -1,5 +1,10 @@
 #include <iostream>
 #include <vector>
+#include <chrono>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <utility>
 
 #include <cstdint>
 #include <cassert>
@@ -77,11 +82,277 @@ void subscribe_lambda (int x)
 		std::cout << "lambda_" << x << " event_data " << event_data << std::endl;
 	};
 
-	auto d6 = event_handler.subscribe( Mylib::Event::make_callback_lambda<int>(lambda_1) );
+	[[maybe_unused]] auto d6 = event_handler.subscribe( Mylib::Event::make_callback_lambda<int>(lambda_1) );
 }
 
 test_t test;
 
+void test_dense_handler ()
+{
+	Mylib::Event::DenseHandler<int> handler;
+	using Descriptor = Mylib::Event::DenseHandler<int>::Descriptor;
+
+	int sum = 0;
+	std::array<uint64_t, 16> big = {}; // doesn't fit inline
+	big[15] = 1000;
+
+	Descriptor d1 = handler.subscribe([&sum] (int& event) { sum += event; });
+	Descriptor d2 = handler.subscribe([&sum, big] (int& event) { sum += big[15]; });
+	Descriptor d3 = handler.subscribe( Mylib::Event::make_callback_object<int>(test, &test_t::callback_3) );
+
+	handler.publish(1);
+	std::cout << "dense handler sum " << sum << std::endl;
+	assert(sum == 1001);
+
+	handler.unsubscribe(d3);
+	assert(!handler.is_valid(d3));
+	assert(handler.get_n_subscribers() == 2);
+
+	// a one-shot subscriber, that unsubscribes itself and subscribes another one
+	Descriptor d4;
+	int n_calls = 0;
+
+	d4 = handler.subscribe([&] (int& event) {
+		n_calls++;
+		handler.unsubscribe(d4);
+		handler.subscribe([&n_calls] (int&) { n_calls += 10; });
+	});
+
+	handler.publish(1);
+	assert(n_calls == 1);
+	assert(!handler.is_valid(d4));
+	assert(handler.get_n_subscribers() == 3);
+
+	handler.publish(1);
+	assert(n_calls == 11);
+
+	// unsubscribe another subscriber from inside publish
+	handler.subscribe([&] (int&) {
+		if (handler.is_valid(d1))
+			handler.unsubscribe(d1);
+	});
+
+	sum = 0;
+	handler.publish(1);
+	handler.publish(1);
+	std::cout << "dense handler sum " << sum << std::endl;
+	assert(handler.is_valid(d2) && !handler.is_valid(d1));
+	assert(handler.get_n_subscribers() == 3);
+
+	try {
+		handler.unsubscribe(d1);
+		assert(0);
+	}
+	catch (const Mylib::EventSubscriberNotFoundException&) {
+		std::cout << "\tunsubscribing twice throws" << std::endl;
+	}
+}
+
+template <typename Thandler>
+void test_unsubscribe_many ()
+{
+	Thandler handler;
+	std::vector<typename Thandler::Descriptor> descriptors;
+	int sum = 0;
+
+	for (int i = 0; i < 5; i++)
+		descriptors.push_back( handler.subscribe( Mylib::Event::make_callback_lambda<int>([&sum, i] (int& event) { sum += (1 << i); }) ) );
+
+	handler.unsubscribe(descriptors[2]);
+	handler.publish(0);
+	assert(sum == (1 + 2 + 8 + 16));
+
+	// descriptors[2] is not valid anymore, so nothing is unsubscribed
+	try {
+		handler.unsubscribe_many(std::span(descriptors.data(), 2 + 1));
+		assert(0);
+	}
+	catch (const Mylib::EventSubscriberNotFoundException&) {
+	}
+
+	sum = 0;
+	handler.publish(0);
+	assert(sum == (1 + 2 + 8 + 16));
+
+	// repeated descriptors are fine
+	std::vector<typename Thandler::Descriptor> batch = { descriptors[0], descriptors[3], descriptors[0] };
+	handler.unsubscribe_many(batch);
+
+	sum = 0;
+	handler.publish(0);
+	std::cout << "sum after unsubscribe_many " << sum << std::endl;
+	assert(sum == (2 + 16));
+}
+
+// ---------------------------------------------------
+
+// Subscribe a batch of widgets and unsubscribe them in random order,
+// on top of a number of long lived subscribers.
+
+template <typename Thandler>
+void benchmark_churn_handler (const char *name, const uint32_t n_background, const bool many)
+{
+	constexpr uint32_t n_widgets = 100;
+	constexpr uint32_t n_rounds = 20000;
+
+	Thandler handler;
+	std::vector<typename Thandler::Descriptor> widgets(n_widgets);
+	std::mt19937 rng(12345);
+	int sum = 0;
+
+	for (uint32_t i = 0; i < n_background; i++)
+		handler.subscribe( Mylib::Event::make_callback_lambda<int>([&sum] (int& event) { sum += event; }) );
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t round = 0; round < n_rounds; round++) {
+		for (auto& d : widgets)
+			d = handler.subscribe( Mylib::Event::make_callback_lambda<int>([&sum] (int& event) { sum -= event; }) );
+
+		std::shuffle(widgets.begin(), widgets.end(), rng);
+
+		if (many)
+			handler.unsubscribe_many(widgets);
+		else {
+			for (auto& d : widgets)
+				handler.unsubscribe(d);
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+	std::cout << "\t" << name << ": " << (ns / static_cast<double>(n_rounds * n_widgets)) << " ns per subscribe + unsubscribe" << std::endl;
+}
+
+void benchmark_churn ()
+{
+	for (const uint32_t n_background : { 10, 1000, 10000 }) {
+		std::cout << "churn with " << n_background << " long lived subscribers" << std::endl;
+
+		benchmark_churn_handler<Mylib::Event::Handler<int>>("Handler unsubscribe", n_background, false);
+		benchmark_churn_handler<Mylib::Event::Handler<int>>("Handler unsubscribe_many", n_background, true);
+		benchmark_churn_handler<Mylib::Event::DenseHandler<int>>("DenseHandler unsubscribe", n_background, false);
+		benchmark_churn_handler<Mylib::Event::DenseHandler<int>>("DenseHandler unsubscribe_many", n_background, true);
+	}
+}
+
+// ---------------------------------------------------
+
+uint64_t publish_sum = 0;
+volatile int publish_noise = 0; // otherwise the compiler may compute the whole loop of a StaticHandler at compile time
+
+template <typename Thandler>
+void benchmark_publish_loop (const char *name, Thandler& handler, const uint32_t n_subscribers)
+{
+	constexpr uint64_t n_calls = 20000000;
+	const uint64_t n_publish = n_calls / n_subscribers;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint64_t i = 0; i < n_publish; i++)
+		handler.publish(static_cast<int>(i) + publish_noise);
+
+	auto end = std::chrono::steady_clock::now();
+
+	const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+	std::cout << "\t" << name << ": " << (ns / static_cast<double>(n_publish * n_subscribers)) << " ns per call" << std::endl;
+}
+
+template <typename Thandler, typename Tsubscribe>
+void benchmark_handler (const char *name, const uint32_t n_subscribers, Tsubscribe subscribe)
+{
+	Thandler handler;
+
+	for (uint32_t i = 0; i < n_subscribers; i++)
+		subscribe(handler, i);
+
+	benchmark_publish_loop(name, handler, n_subscribers);
+}
+
+void benchmark_publish ()
+{
+	for (const uint32_t n_subscribers : { 1, 10, 1000, 100000 }) {
+		std::cout << "publish with " << n_subscribers << " subscribers" << std::endl;
+
+		benchmark_handler<Mylib::Event::Handler<int>>("Handler", n_subscribers, [] (auto& handler, const uint32_t i) {
+			handler.subscribe( Mylib::Event::make_callback_lambda<int>([i] (int& event) { publish_sum += event + i; }) );
+		});
+
+		benchmark_handler<Mylib::Event::DenseHandler<int>>("DenseHandler", n_subscribers, [] (auto& handler, const uint32_t i) {
+			handler.subscribe([i] (int& event) { publish_sum += event + i; });
+		});
+	}
+
+	std::cout << "checksum " << publish_sum << std::endl;
+}
+
+// ---------------------------------------------------
+
+void test_static_handler ()
+{
+	int sum = 0;
+
+	auto handler = Mylib::Event::make_static_handler<int>(
+		[&sum] (int& event) { sum += event; },
+		Mylib::Event::make_callback_object<int>(test, &test_t::callback_3),
+		[&sum] (int& event) { sum *= 2; event++; }
+	);
+
+	static_assert(decltype(handler)::get_n_subscribers() == 3);
+
+	int event = 5;
+	handler.publish(event);
+	std::cout << "static handler sum " << sum << " event " << event << std::endl;
+	assert(sum == 10 && event == 6); // called in order
+
+	handler.publish(1);
+	assert(sum == 22);
+
+	// same signature as Handler::publish
+	auto publish = [] (auto& h) { h.publish(2); };
+	publish(handler);
+	publish(event_handler);
+	assert(sum == 48);
+}
+
+// one lambda type per subscriber, to match the handlers in benchmark_publish
+template <std::size_t... i>
+auto make_static_benchmark_handler (std::index_sequence<i...>)
+{
+	return Mylib::Event::make_static_handler<int>(
+		[] (int& event) { publish_sum += event + i; }...
+	);
+}
+
+void benchmark_static_handler ()
+{
+	for (const uint32_t n_subscribers : { 1, 10 }) {
+		std::cout << "publish with " << n_subscribers << " fixed subscribers" << std::endl;
+
+		benchmark_handler<Mylib::Event::Handler<int>>("Handler", n_subscribers, [] (auto& handler, const uint32_t i) {
+			handler.subscribe( Mylib::Event::make_callback_lambda<int>([i] (int& event) { publish_sum += event + i; }) );
+		});
+
+		benchmark_handler<Mylib::Event::DenseHandler<int>>("DenseHandler", n_subscribers, [] (auto& handler, const uint32_t i) {
+			handler.subscribe([i] (int& event) { publish_sum += event + i; });
+		});
+
+		if (n_subscribers == 1) {
+			auto handler = make_static_benchmark_handler(std::make_index_sequence<1>());
+			benchmark_publish_loop("StaticHandler", handler, n_subscribers);
+		}
+		else {
+			auto handler = make_static_benchmark_handler(std::make_index_sequence<10>());
+			benchmark_publish_loop("StaticHandler", handler, n_subscribers);
+		}
+	}
+
+	std::cout << "checksum " << publish_sum << std::endl;
+}
+
 int main ()
 {
 	auto callback1 = Mylib::Event::make_callback_object_with_params<int>(test, &test_t::callback_1, 10);
@@ -89,7 +360,7 @@ int main ()
 	auto d1 = event_handler.subscribe(callback1);
 	event_handler.unsubscribe(d1);
 	
-	auto d3 = event_handler.subscribe( Mylib::Event::make_callback_object<int>(test, &test_t::callback_3) );
+	[[maybe_unused]] auto d3 = event_handler.subscribe( Mylib::Event::make_callback_object<int>(test, &test_t::callback_3) );
 
 	subscribe_lambda(2);
 
@@ -106,5 +377,24 @@ int main ()
 
 	//auto callback3 = Mylib::Trigger::make_callback_object<int>(test, &test_t::callback_3);
 
+	std::cout << "----------------------" << std::endl;
+	test_dense_handler();
+
+	std::cout << "----------------------" << std::endl;
+	test_unsubscribe_many<Mylib::Event::Handler<int>>();
+	test_unsubscribe_many<Mylib::Event::DenseHandler<int>>();
+
+	std::cout << "----------------------" << std::endl;
+	test_static_handler();
+
+	std::cout << "----------------------" << std::endl;
+	benchmark_publish();
+
+	std::cout << "----------------------" << std::endl;
+	benchmark_static_handler();
+
+	std::cout << "----------------------" << std::endl;
+	benchmark_churn();
+
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include <iostream>
+#include <memory>
+#include <array>
+#include <string>
+
+#include <cstdint>
+#include <cassert>
+
+#include <my-lib/inline-function.h>
+#include <my-lib/event.h>
+
+using Function = Mylib::InlineFunction<int (int), 32>;
+
+// counts the live objects, to check the InlineFunction destroys its callable
+struct Counted {
+	static inline int32_t n_alive = 0;
+
+	int32_t value;
+
+	Counted (const int32_t value_)
+		: value(value_)
+	{
+		n_alive++;
+	}
+
+	Counted (const Counted& other)
+		: value(other.value)
+	{
+		n_alive++;
+	}
+
+	~Counted ()
+	{
+		n_alive--;
+	}
+
+	int operator() (int x)
+	{
+		return x + this->value;
+	}
+};
+
+// counts the live allocations, to check the callables that don't fit inline use the manager
+class CountingManager : public Mylib::Memory::Manager
+{
+public:
+	int32_t n_allocated = 0;
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		this->n_allocated++;
+		return Mylib::Memory::m_allocate(type_size * count, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		this->n_allocated--;
+		Mylib::Memory::m_deallocate(p, type_size * count, align);
+	}
+};
+
+struct test_t {
+	int b = 7;
+
+	void callback (int& event)
+	{
+		event += this->b;
+	}
+};
+
+int main ()
+{
+	std::cout << "sizeof Function is " << sizeof(Function) << std::endl;
+
+	Function empty;
+	assert(!empty);
+
+	// small lambda, stored inline
+	int base = 10;
+	auto small = [base] (int x) { return x + base; };
+	static_assert(Function::fits_inline<decltype(small)>());
+
+	Function f = small;
+	std::cout << "f(5) = " << f(5) << std::endl;
+	assert(f(5) == 15);
+
+	// big lambda, allocated
+	std::array<int, 16> values = {};
+	values[15] = 100;
+	auto big = [values] (int x) { return x + values[15]; };
+	static_assert(!Function::fits_inline<decltype(big)>());
+
+	Function g = big;
+	std::cout << "g(5) = " << g(5) << std::endl;
+	assert(g(5) == 105);
+
+	// copies and moves, inline and allocated
+	Function f2 = f;
+	Function g2 = g;
+	assert(f2(1) == 11 && g2(1) == 101);
+
+	Function f3 = std::move(f2);
+	Function g3 = std::move(g2);
+	assert(!f2 && !g2);
+	assert(f3(1) == 11 && g3(1) == 101);
+
+	f3 = g3;
+	assert(f3(1) == 101);
+
+	f3 = nullptr;
+	assert(!f3);
+
+	// move-only callable
+	auto ptr = std::make_unique<int>(1000);
+	Function h = [ptr = std::move(ptr)] (int x) { return x + *ptr; };
+	assert(h(1) == 1001);
+
+	try {
+		Function h2 = h;
+		assert(0);
+	}
+	catch (const Mylib::Exception& e) {
+		std::cout << "\tcopying a move-only callable throws" << std::endl;
+	}
+
+	Function h3 = std::move(h);
+	assert(h3(2) == 1002);
+
+	// destructors
+	{
+		Function c1 = Counted(1);
+		Function c2 = c1;
+		Function c3 = std::move(c1);
+		assert(Counted::n_alive == 2);
+		assert(c2(1) == 2 && c3(1) == 2);
+
+		c3.emplace<Counted>(5);
+		assert(c3(1) == 6);
+		assert(Counted::n_alive == 2);
+	}
+
+	std::cout << "Counted alive after scope: " << Counted::n_alive << std::endl;
+	assert(Counted::n_alive == 0);
+
+	// memory manager of the allocated callables
+	CountingManager manager;
+
+	{
+		Function small_m(manager, small);
+		assert(manager.n_allocated == 0);
+
+		Function big_m(manager, big);
+		assert(manager.n_allocated == 1);
+		assert(big_m(5) == 105);
+
+		Function big_copy = big_m; // same manager as the source
+		Function big_moved = std::move(big_m);
+		assert(manager.n_allocated == 2);
+		assert(big_copy(1) == 101 && big_moved(1) == 101);
+	}
+
+	std::cout << "manager allocations after scope: " << manager.n_allocated << std::endl;
+	assert(manager.n_allocated == 0);
+
+	// the handlers give their manager to the callbacks
+	{
+		Mylib::Event::Handler<int> handler(manager);
+
+		auto d1 = handler.subscribe([base] (int& event) { event += base; });
+		const int32_t n_small = manager.n_allocated;
+
+		std::array<int, 32> big_values = {};
+		big_values[31] = 100;
+		auto d2 = handler.subscribe([big_values] (int& event) { event += big_values[31]; });
+		assert(manager.n_allocated == (n_small + 2)); // list node and callable
+
+		int event = 1;
+		handler.publish(event);
+		assert(event == 111);
+
+		handler.unsubscribe(d2);
+		handler.unsubscribe(d1);
+	}
+
+	assert(manager.n_allocated == 0);
+
+	// member function binding, made by the event helpers
+	test_t test;
+	auto member = Mylib::Event::make_callback_object<int>(test, &test_t::callback);
+	Mylib::InlineFunction<void (int&), Mylib::Event::default_callback_size> m = member;
+	static_assert(decltype(m)::fits_inline<decltype(member)>());
+
+	int event = 1;
+	m(event);
+	assert(event == 8);
+
+	std::cout << "all tests passed" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,611 @@
+/*
+	Allocation benchmarks with the standard workloads:
+
+	- LIFO, FIFO and random free order, for a single size;
+	- mixed sizes, taken from the size classes of a PoolManager;
+	- producer/consumer across threads;
+	- larson (threads replace random objects, and pass them to the next thread);
+	- cache-scratch (each thread hammers an object it allocated itself);
+	- std::list and std::map through AllocatorSTL.
+
+	Each run reports ns/op (an op is an allocation or a deallocation),
+	how much the RSS grew, and the cache misses when perf counters are
+	available (perf_event_paranoid may forbid them).
+
+	Each run goes in its own process (fork), so the memory kept by one
+	allocator doesn't pollute the RSS and the caches of the next one.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <barrier>
+#include <atomic>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <my-lib/memory-pool.h>
+
+using Mylib::Memory::Manager;
+using Mylib::Memory::DefaultManager;
+using Mylib::Memory::PoolManager;
+using Mylib::Memory::ConcurrentPoolManager;
+using Mylib::Memory::AllocatorSTL;
+
+// ---------------------------------------------------
+
+constexpr size_t max_type_size = 256;
+constexpr size_t step_size = 16;
+
+constexpr uint32_t n_order_objs = 100000;
+constexpr uint32_t n_order_rounds = 20;
+constexpr uint32_t n_mixed_slots = 10000;
+constexpr uint32_t n_mixed_ops = 4000000;
+constexpr uint32_t n_bench_threads = 4;
+constexpr uint32_t n_producer_objs = 500000;
+constexpr size_t producer_size = 64;
+constexpr uint32_t n_larson_slots = 1000;
+constexpr uint32_t n_larson_ops = 100000;
+constexpr uint32_t n_larson_epochs = 10;
+constexpr uint32_t n_scratch_rounds = 100000;
+constexpr uint32_t n_scratch_writes = 100;
+constexpr size_t scratch_size = 8;
+constexpr uint32_t n_list_elements = 1000000;
+constexpr uint32_t n_map_elements = 200000;
+
+// ---------------------------------------------------
+
+// glibc malloc, with the Manager interface
+class MallocManager : public Manager
+{
+public:
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) [[unlikely]]
+			return std::aligned_alloc(align, ((type_size * count + align - 1) / align) * align);
+		return std::malloc(type_size * count);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		std::free(p);
+	}
+};
+
+// ---------------------------------------------------
+
+class CacheMissCounter
+{
+private:
+	int fd;
+
+public:
+	CacheMissCounter ()
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = PERF_COUNT_HW_CACHE_MISSES;
+		attr.disabled = 1;
+		attr.inherit = 1; // count the threads created by the workload as well
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		this->fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	~CacheMissCounter ()
+	{
+		if (this->fd >= 0)
+			close(this->fd);
+	}
+
+	void start ()
+	{
+		if (this->fd >= 0) {
+			ioctl(this->fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(this->fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	// -1 when the counters are not available
+	int64_t stop ()
+	{
+		if (this->fd < 0)
+			return -1;
+
+		ioctl(this->fd, PERF_EVENT_IOC_DISABLE, 0);
+
+		uint64_t value;
+
+		if (read(this->fd, &value, sizeof(value)) != sizeof(value))
+			return -1;
+
+		return static_cast<int64_t>(value);
+	}
+};
+
+// ---------------------------------------------------
+
+struct result_t {
+	double ns_per_op;
+	int64_t rss_kb;       // how much the RSS grew during the run
+	int64_t cache_misses; // -1 when not available
+};
+
+int64_t get_rss_kb ()
+{
+	FILE *fp = std::fopen("/proc/self/statm", "r");
+	long size = 0, pages = 0;
+
+	if (fp != nullptr) {
+		if (std::fscanf(fp, "%ld %ld", &size, &pages) != 2)
+			pages = 0;
+		std::fclose(fp);
+	}
+
+	return (static_cast<int64_t>(pages) * sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+int64_t get_max_rss_kb ()
+{
+	rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+// Runs workload(*make_manager()) in a child process.
+// The workload returns the number of ops it did.
+
+template <typename Tmake, typename Tworkload>
+result_t run_isolated (Tmake make_manager, Tworkload& workload)
+{
+	int fds[2];
+	result_t result { 0, 0, -1 };
+
+	mylib_assert(pipe(fds) == 0)
+
+	std::cout.flush();
+
+	const pid_t pid = fork();
+
+	mylib_assert(pid >= 0)
+
+	if (pid == 0) {
+		close(fds[0]);
+
+		auto manager = make_manager();
+		const int64_t rss_before = get_rss_kb();
+		CacheMissCounter counter;
+
+		counter.start();
+		auto start = std::chrono::steady_clock::now();
+
+		const uint64_t n_ops = workload(*manager);
+
+		auto end = std::chrono::steady_clock::now();
+
+		result.cache_misses = counter.stop();
+		result.ns_per_op = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()) / static_cast<double>(n_ops);
+		result.rss_kb = get_max_rss_kb() - rss_before;
+
+		if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+			_exit(1);
+
+		// skip the destructors, we only want the numbers
+		_exit(0);
+	}
+
+	close(fds[1]);
+
+	const bool ok = (read(fds[0], &result, sizeof(result)) == sizeof(result));
+	int status;
+
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+
+	mylib_assert_msg(ok && WIFEXITED(status) && WEXITSTATUS(status) == 0, "benchmark process failed")
+
+	return result;
+}
+
+void print_result (const char *manager_name, const result_t& result)
+{
+	std::cout << "\t" << std::left << std::setw(24) << manager_name << std::right
+		<< std::fixed << std::setprecision(2) << std::setw(8) << result.ns_per_op << " ns/op"
+		<< ", rss +" << result.rss_kb << " KB"
+		<< ", cache misses ";
+
+	if (result.cache_misses >= 0)
+		std::cout << result.cache_misses;
+	else
+		std::cout << "n/a";
+
+	std::cout << std::endl;
+}
+
+// PoolManager is not thread-safe, so it only runs the single thread workloads.
+
+template <typename Tworkload>
+void run_single_thread (const char *workload_name, Tworkload workload)
+{
+	std::cout << workload_name << std::endl;
+
+	print_result("malloc", run_isolated([] { return std::make_unique<MallocManager>(); }, workload));
+	print_result("DefaultManager", run_isolated([] { return std::make_unique<DefaultManager>(); }, workload));
+	print_result("PoolManager", run_isolated([] { return std::make_unique<PoolManager>(max_type_size, step_size); }, workload));
+}
+
+template <typename Tworkload>
+void run_multi_thread (const char *workload_name, Tworkload workload)
+{
+	std::cout << workload_name << std::endl;
+
+	print_result("malloc", run_isolated([] { return std::make_unique<MallocManager>(); }, workload));
+	print_result("DefaultManager", run_isolated([] { return std::make_unique<DefaultManager>(); }, workload));
+	print_result("ConcurrentPoolManager", run_isolated([] { return std::make_unique<ConcurrentPoolManager>(max_type_size, step_size); }, workload));
+}
+
+// ---------------------------------------------------
+
+// Allocates n_order_objs objects, and frees them in the given order.
+
+template <typename Tmanager>
+uint64_t free_in_order (Tmanager& manager, const size_t size, const std::vector<uint32_t>& order)
+{
+	std::vector<uint8_t*> ptrs(n_order_objs);
+
+	for (uint32_t round = 0; round < n_order_rounds; round++) {
+		for (uint32_t i = 0; i < n_order_objs; i++) {
+			ptrs[i] = static_cast<uint8_t*>( manager.allocate(size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__) );
+			ptrs[i][0] = static_cast<uint8_t>(i);
+		}
+
+		for (const uint32_t i : order) {
+			mylib_assert(ptrs[i][0] == static_cast<uint8_t>(i))
+			manager.deallocate(ptrs[i], size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		}
+	}
+
+	return static_cast<uint64_t>(n_order_objs) * n_order_rounds * 2;
+}
+
+void benchmark_free_order ()
+{
+	constexpr size_t size = 32;
+
+	std::vector<uint32_t> fifo(n_order_objs);
+
+	for (uint32_t i = 0; i < n_order_objs; i++)
+		fifo[i] = i;
+
+	std::vector<uint32_t> lifo(fifo.rbegin(), fifo.rend());
+	std::vector<uint32_t> random = fifo;
+	std::shuffle(random.begin(), random.end(), std::mt19937(12345));
+
+	run_single_thread("LIFO, 32 bytes", [&] (auto& manager) { return free_in_order(manager, size, lifo); });
+	run_single_thread("FIFO, 32 bytes", [&] (auto& manager) { return free_in_order(manager, size, fifo); });
+	run_single_thread("random order, 32 bytes", [&] (auto& manager) { return free_in_order(manager, size, random); });
+}
+
+// ---------------------------------------------------
+
+void benchmark_mixed_sizes ()
+{
+	// the sizes of the classes of the PoolManager we compare against
+	PoolManager reference(max_type_size, step_size);
+	std::vector<uint32_t> sizes;
+
+	for (const Mylib::Memory::PoolCore *pool : reference.get_pools())
+		sizes.push_back(pool->get_chunk_size());
+
+	// Each op either allocates into an empty slot or frees the object of a live slot.
+	std::mt19937 rng(12345);
+	std::uniform_int_distribution<uint32_t> slot_dist(0, n_mixed_slots - 1);
+	std::uniform_int_distribution<uint32_t> size_dist(0, sizes.size() - 1);
+	std::vector<uint32_t> slot_ops(n_mixed_ops);
+	std::vector<uint32_t> size_ops(n_mixed_ops);
+
+	for (uint32_t i = 0; i < n_mixed_ops; i++) {
+		slot_ops[i] = slot_dist(rng);
+		size_ops[i] = sizes[size_dist(rng)];
+	}
+
+	std::cout << "mixed sizes from " << sizes.size() << " size classes" << std::endl;
+
+	run_single_thread("mixed sizes, random order", [&] (auto& manager) -> uint64_t {
+		std::vector<void*> ptrs(n_mixed_slots, nullptr);
+		std::vector<uint32_t> ptr_sizes(n_mixed_slots, 0);
+
+		for (uint32_t i = 0; i < n_mixed_ops; i++) {
+			const uint32_t slot = slot_ops[i];
+
+			if (ptrs[slot] == nullptr) {
+				ptrs[slot] = manager.allocate(size_ops[i], 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+				ptr_sizes[slot] = size_ops[i];
+				std::memset(ptrs[slot], 0, 8);
+			}
+			else {
+				manager.deallocate(ptrs[slot], ptr_sizes[slot], 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+				ptrs[slot] = nullptr;
+			}
+		}
+
+		uint64_t n_ops = n_mixed_ops;
+
+		for (uint32_t slot = 0; slot < n_mixed_slots; slot++) {
+			if (ptrs[slot] != nullptr) {
+				manager.deallocate(ptrs[slot], ptr_sizes[slot], 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+				n_ops++;
+			}
+		}
+
+		return n_ops;
+	});
+}
+
+// ---------------------------------------------------
+
+// Single producer, single consumer ring.
+
+class Ring
+{
+private:
+	static constexpr uint32_t capacity = 1024;
+
+	void *buffer[capacity];
+	alignas(Mylib::Memory::cache_line_size) std::atomic<uint32_t> head = 0;
+	alignas(Mylib::Memory::cache_line_size) std::atomic<uint32_t> tail = 0;
+
+public:
+	void push (void *p)
+	{
+		const uint32_t t = this->tail.load(std::memory_order_relaxed);
+
+		while ((t - this->head.load(std::memory_order_acquire)) == capacity)
+			std::this_thread::yield();
+
+		this->buffer[t % capacity] = p;
+		this->tail.store(t + 1, std::memory_order_release);
+	}
+
+	void* pop ()
+	{
+		const uint32_t h = this->head.load(std::memory_order_relaxed);
+
+		while (this->tail.load(std::memory_order_acquire) == h)
+			std::this_thread::yield();
+
+		void *p = this->buffer[h % capacity];
+		this->head.store(h + 1, std::memory_order_release);
+		return p;
+	}
+};
+
+void benchmark_producer_consumer ()
+{
+	constexpr uint32_t n_pairs = n_bench_threads / 2;
+
+	run_multi_thread("producer/consumer, 64 bytes", [&] (auto& manager) -> uint64_t {
+		std::vector<Ring> rings(n_pairs);
+		std::vector<std::thread> threads;
+
+		for (uint32_t pair = 0; pair < n_pairs; pair++) {
+			threads.emplace_back([&manager, &ring = rings[pair]] () {
+				for (uint32_t i = 0; i < n_producer_objs; i++) {
+					uint32_t *p = static_cast<uint32_t*>( manager.allocate(producer_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__) );
+					*p = i;
+					ring.push(p);
+				}
+			});
+
+			threads.emplace_back([&manager, &ring = rings[pair]] () {
+				for (uint32_t i = 0; i < n_producer_objs; i++) {
+					uint32_t *p = static_cast<uint32_t*>( ring.pop() );
+					mylib_assert(*p == i)
+					manager.deallocate(p, producer_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+				}
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		return static_cast<uint64_t>(n_producer_objs) * n_pairs * 2;
+	});
+}
+
+// ---------------------------------------------------
+
+void benchmark_larson ()
+{
+	run_multi_thread("larson", [&] (auto& manager) -> uint64_t {
+		struct slot_t {
+			void *p;
+			uint32_t size;
+		};
+
+		// At the end of each epoch, each thread gives its objects to the next thread,
+		// so most of the frees are of objects allocated by other threads.
+		std::vector<std::vector<slot_t>> slots(n_bench_threads, std::vector<slot_t>(n_larson_slots));
+		std::barrier sync(n_bench_threads);
+
+		std::mt19937 rng(12345);
+		std::uniform_int_distribution<uint32_t> size_dist(8, max_type_size);
+
+		for (auto& thread_slots : slots) {
+			for (slot_t& slot : thread_slots) {
+				slot.size = size_dist(rng);
+				slot.p = manager.allocate(slot.size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+			}
+		}
+
+		auto worker = [&] (const uint32_t tid) {
+			std::mt19937 rng(tid);
+			std::uniform_int_distribution<uint32_t> slot_dist(0, n_larson_slots - 1);
+			std::uniform_int_distribution<uint32_t> size_dist(8, max_type_size);
+
+			for (uint32_t epoch = 0; epoch < n_larson_epochs; epoch++) {
+				std::vector<slot_t>& thread_slots = slots[(tid + epoch) % n_bench_threads];
+
+				for (uint32_t i = 0; i < n_larson_ops; i++) {
+					slot_t& slot = thread_slots[slot_dist(rng)];
+					manager.deallocate(slot.p, slot.size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+					slot.size = size_dist(rng);
+					slot.p = manager.allocate(slot.size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+					std::memset(slot.p, 0, 8);
+				}
+
+				sync.arrive_and_wait();
+			}
+		};
+
+		std::vector<std::thread> threads;
+
+		for (uint32_t tid = 0; tid < n_bench_threads; tid++)
+			threads.emplace_back(worker, tid);
+
+		for (auto& thread : threads)
+			thread.join();
+
+		for (auto& thread_slots : slots) {
+			for (slot_t& slot : thread_slots)
+				manager.deallocate(slot.p, slot.size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		}
+
+		return static_cast<uint64_t>(n_larson_ops) * n_larson_epochs * n_bench_threads * 2;
+	});
+}
+
+// ---------------------------------------------------
+
+void benchmark_cache_scratch ()
+{
+	run_multi_thread("cache-scratch, 8 bytes", [&] (auto& manager) -> uint64_t {
+		// Objects allocated together by one thread usually share cache lines.
+		// Each thread frees one of them and then works on its own objects.
+		// If the allocator gives the same memory back to it, the threads
+		// write to the same cache lines (passive false sharing).
+		std::vector<void*> initial(n_bench_threads);
+
+		for (void*& p : initial)
+			p = manager.allocate(scratch_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+		auto worker = [&] (const uint32_t tid) {
+			manager.deallocate(initial[tid], scratch_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+			for (uint32_t round = 0; round < n_scratch_rounds; round++) {
+				volatile uint8_t *p = static_cast<uint8_t*>( manager.allocate(scratch_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__) );
+
+				for (uint32_t i = 0; i < n_scratch_writes; i++)
+					p[i % scratch_size] = static_cast<uint8_t>(i);
+
+				manager.deallocate(const_cast<uint8_t*>(p), scratch_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+			}
+		};
+
+		std::vector<std::thread> threads;
+
+		for (uint32_t tid = 0; tid < n_bench_threads; tid++)
+			threads.emplace_back(worker, tid);
+
+		for (auto& thread : threads)
+			thread.join();
+
+		return (static_cast<uint64_t>(n_scratch_rounds) * 2 + 1) * n_bench_threads;
+	});
+}
+
+// ---------------------------------------------------
+
+void benchmark_stl ()
+{
+	run_single_thread("std::list<uint64_t>", [&] (auto& manager) -> uint64_t {
+		using Tmanager = std::remove_reference_t<decltype(manager)>;
+		std::list<uint64_t, AllocatorSTL<uint64_t, Tmanager>> list(manager);
+		uint64_t n_ops = 0;
+
+		for (uint32_t i = 0; i < n_list_elements; i++)
+			list.push_back(i);
+
+		n_ops += n_list_elements;
+
+		// remove every other element, and fill the holes again
+		for (auto it = list.begin(); it != list.end(); ) {
+			it = list.erase(it);
+			++it;
+		}
+
+		n_ops += n_list_elements / 2;
+
+		for (auto it = list.begin(); it != list.end(); ++it)
+			list.insert(it, 0);
+
+		n_ops += n_list_elements / 2;
+		n_ops += list.size();
+
+		list.clear();
+
+		return n_ops;
+	});
+
+	std::vector<uint32_t> keys(n_map_elements);
+
+	{
+		std::mt19937 rng(12345);
+
+		for (uint32_t& key : keys)
+			key = rng();
+	}
+
+	run_single_thread("std::map<uint32_t, uint32_t>", [&] (auto& manager) -> uint64_t {
+		using Tmanager = std::remove_reference_t<decltype(manager)>;
+		using Tpair = std::pair<const uint32_t, uint32_t>;
+		std::map<uint32_t, uint32_t, std::less<uint32_t>, AllocatorSTL<Tpair, Tmanager>> map(manager);
+		uint64_t n_ops = 0;
+
+		for (const uint32_t key : keys)
+			map[key] = key;
+
+		n_ops += map.size();
+
+		for (uint32_t i = 0; i < keys.size(); i += 2)
+			n_ops += map.erase(keys[i]);
+
+		n_ops += map.size();
+
+		map.clear();
+
+		return n_ops;
+	});
+}
+
+// ---------------------------------------------------
+
+int main ()
+{
+	benchmark_free_order();
+	benchmark_mixed_sizes();
+	benchmark_producer_consumer();
+	benchmark_larson();
+	benchmark_cache_scratch();
+	benchmark_stl();
+
+	return 0;
+}
@@ -4,6 +4,20 @@
 #include <mutex>
 #include <memory>
 #include <utility>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <random>
+#include <algorithm>
+#include <cstring>
+#include <memory_resource>
+#include <map>
+#include <string>
+
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include <cassert>
 
@@ -246,8 +260,1629 @@ void test_shared_ptr ()
 	std::cout << "ptr " << ptr.get() << std::endl;
 }
 
+// ---------------------------------------------------
+
+#define n_threads 4
+#define n_thread_rounds 200
+#define n_thread_objs 10000
+
+struct alignas(16) obj_t {
+	uint64_t a;
+	uint64_t b;
+	uint64_t c;
+};
+
+template <typename Talloc, typename Tfree>
+uint64_t benchmark_threads (Talloc alloc, Tfree free, const bool cross_thread)
+{
+	// Each thread allocates a batch of objects and frees them.
+	// When cross_thread is true, each thread frees the objects allocated by its neighbour,
+	// which exercises the remote-free path of ThreadCachedPoolCore.
+
+	std::vector<std::vector<obj_t*>> objs(n_threads, std::vector<obj_t*>(n_thread_objs));
+	std::vector<uint64_t> checksum(n_threads, 0);
+	std::atomic<uint32_t> barrier = 0;
+
+	auto wait_barrier = [&barrier] (const uint32_t generation) {
+		barrier.fetch_add(1);
+		while (barrier.load() < (generation * n_threads))
+			std::this_thread::yield();
+	};
+
+	auto worker = [&] (const uint32_t tid) {
+		uint32_t generation = 0;
+
+		for (uint32_t round = 0; round < n_thread_rounds; round++) {
+			for (uint32_t i = 0; i < n_thread_objs; i++) {
+				obj_t *obj = alloc();
+				obj->a = i;
+				objs[tid][i] = obj;
+			}
+
+			const uint32_t target = cross_thread ? ((tid + 1) % n_threads) : tid;
+
+			if (cross_thread)
+				wait_barrier(++generation);
+
+			for (uint32_t i = 0; i < n_thread_objs; i++) {
+				checksum[tid] += objs[target][i]->a;
+				free(objs[target][i]);
+			}
+
+			if (cross_thread)
+				wait_barrier(++generation);
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+
+	for (uint32_t tid = 0; tid < n_threads; tid++)
+		threads.emplace_back(worker, tid);
+
+	for (auto& thread : threads)
+		thread.join();
+
+	auto end = std::chrono::steady_clock::now();
+
+	uint64_t total = 0;
+	for (const uint64_t c : checksum)
+		total += c;
+
+	mylib_assert(total == (static_cast<uint64_t>(n_thread_objs) * (n_thread_objs - 1) / 2) * n_thread_rounds * n_threads)
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+}
+
+void benchmark_thread_safe_pools ()
+{
+	for (const bool cross_thread : { false, true }) {
+		std::cout << (cross_thread ? "cross-thread frees" : "same-thread frees") << std::endl;
+
+		{
+			Mylib::Memory::PoolCoreSameType<obj_t> pool(1024);
+			std::mutex mutex;
+
+			const uint64_t ms = benchmark_threads(
+				[&] () -> obj_t* { std::lock_guard<std::mutex> lock(mutex); return pool.allocate(); },
+				[&] (obj_t *p) { std::lock_guard<std::mutex> lock(mutex); pool.deallocate(p); },
+				cross_thread);
+
+			std::cout << "\tPoolCore + mutex: " << ms << " miliseconds" << std::endl;
+		}
+
+		{
+			Mylib::Memory::ThreadCachedPoolCore pool(sizeof(obj_t), 1024, alignof(obj_t));
+
+			const uint64_t ms = benchmark_threads(
+				[&] () -> obj_t* { return static_cast<obj_t*>(pool.allocate()); },
+				[&] (obj_t *p) { pool.deallocate(p); },
+				cross_thread);
+
+			std::cout << "\tThreadCachedPoolCore: " << ms << " miliseconds" << std::endl;
+		}
+
+		{
+			Mylib::Memory::ConcurrentPoolCore pool(sizeof(obj_t), 1024, alignof(obj_t));
+
+			const uint64_t ms = benchmark_threads(
+				[&] () -> obj_t* { return static_cast<obj_t*>(pool.allocate()); },
+				[&] (obj_t *p) { pool.deallocate(p); },
+				cross_thread);
+
+			std::cout << "\tConcurrentPoolCore: " << ms << " miliseconds" << std::endl;
+		}
+
+		{
+			Mylib::Memory::ConcurrentPoolManager manager(1024, 8);
+
+			const uint64_t ms = benchmark_threads(
+				[&] () -> obj_t* { return manager.allocate_type<obj_t>(1); },
+				[&] (obj_t *p) { manager.deallocate_type<obj_t>(p, 1); },
+				cross_thread);
+
+			std::cout << "\tConcurrentPoolManager: " << ms << " miliseconds" << std::endl;
+		}
+
+		{
+			const uint64_t ms = benchmark_threads(
+				[] () -> obj_t* { return static_cast<obj_t*>(malloc(sizeof(obj_t))); },
+				[] (obj_t *p) { ::free(p); },
+				cross_thread);
+
+			std::cout << "\tmalloc: " << ms << " miliseconds" << std::endl;
+		}
+	}
+}
+
+// ---------------------------------------------------
+
+struct trace_op_t {
+	uint32_t id;     // index of the allocation slot
+	uint32_t size;   // 0 means free
+};
+
+std::vector<trace_op_t> build_allocation_trace (const uint32_t n_ops, const uint32_t n_slots)
+{
+	// Mostly small and medium objects, with a few large ones.
+	// Each op either allocates into an empty slot or frees a random live slot.
+
+	std::mt19937 rng(12345);
+	std::uniform_int_distribution<uint32_t> slot_dist(0, n_slots - 1);
+	std::uniform_int_distribution<uint32_t> kind_dist(0, 99);
+	std::uniform_int_distribution<uint32_t> small_dist(1, 256);
+	std::uniform_int_distribution<uint32_t> medium_dist(257, 8 * 1024);
+	std::uniform_int_distribution<uint32_t> large_dist(8 * 1024 + 1, 512 * 1024);
+
+	std::vector<bool> live(n_slots, false);
+	std::vector<trace_op_t> trace;
+	trace.reserve(n_ops + n_slots);
+
+	for (uint32_t i = 0; i < n_ops; i++) {
+		const uint32_t id = slot_dist(rng);
+
+		if (live[id])
+			trace.push_back({ id, 0 });
+		else {
+			const uint32_t kind = kind_dist(rng);
+			const uint32_t size = (kind < 80) ? small_dist(rng) : ((kind < 98) ? medium_dist(rng) : large_dist(rng));
+			trace.push_back({ id, size });
+		}
+
+		live[id] = !live[id];
+	}
+
+	for (uint32_t id = 0; id < n_slots; id++) {
+		if (live[id])
+			trace.push_back({ id, 0 });
+	}
+
+	return trace;
+}
+
+template <typename Talloc, typename Tfree>
+uint64_t replay_allocation_trace (const std::vector<trace_op_t>& trace, const uint32_t n_slots, Talloc alloc, Tfree free)
+{
+	std::vector<uint8_t*> ptrs(n_slots, nullptr);
+	std::vector<uint32_t> sizes(n_slots, 0);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (const trace_op_t& op : trace) {
+		if (op.size != 0) {
+			uint8_t *p = static_cast<uint8_t*>( alloc(op.size) );
+			// touch first and last bytes, so we can check no one else wrote there
+			p[0] = static_cast<uint8_t>(op.id);
+			p[op.size - 1] = static_cast<uint8_t>(op.id);
+			ptrs[op.id] = p;
+			sizes[op.id] = op.size;
+		}
+		else {
+			uint8_t *p = ptrs[op.id];
+			mylib_assert(p[0] == static_cast<uint8_t>(op.id) && p[sizes[op.id] - 1] == static_cast<uint8_t>(op.id))
+			free(p, sizes[op.id]);
+		}
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+}
+
+void test_thread_cache_churn ()
+{
+	// When a thread finishes, the chunks of its cache must go back to the shared pool,
+	// and the cache must be reused by the next threads.
+
+	Mylib::Memory::ThreadCachedPoolCore pool(sizeof(obj_t), 1024, alignof(obj_t), 16);
+	std::vector<obj_t*> leftovers;
+
+	for (uint32_t t = 0; t < 200; t++) {
+		std::thread thread([&pool, &leftovers] () {
+			std::vector<obj_t*> objs;
+
+			for (uint32_t i = 0; i < 500; i++)
+				objs.push_back(static_cast<obj_t*>(pool.allocate()));
+
+			// half is freed by this thread, the other half by the main thread after we finish
+			for (uint32_t i = 0; i < 500; i++) {
+				if (i % 2)
+					pool.deallocate(objs[i]);
+				else
+					leftovers.push_back(objs[i]);
+			}
+		});
+
+		thread.join();
+
+		for (obj_t *obj : leftovers)
+			pool.deallocate(obj);
+
+		leftovers.clear();
+	}
+
+	std::cout << "	thread churn: " << pool.get_n_thread_caches() << " caches, " << pool.get_n_blocks() << " blocks" << std::endl;
+
+	// the main thread has its own cache
+	assert(pool.get_n_thread_caches() == 2);
+	assert(pool.get_n_blocks() == 1);
+
+	// pools whose ids collide in the direct-mapped table keep working
+
+	std::vector<std::unique_ptr<Mylib::Memory::ThreadCachedPoolCore>> pools;
+
+	for (uint32_t i = 0; i < 33; i++)
+		pools.push_back(std::make_unique<Mylib::Memory::ThreadCachedPoolCore>(sizeof(obj_t), 64, alignof(obj_t), 16));
+
+	for (uint32_t i = 0; i < 10000; i++) {
+		auto& p = pools[(i % 3) * 16];
+		p->deallocate(p->allocate());
+	}
+
+	for (uint32_t i = 0; i < 3; i++)
+		assert(pools[i * 16]->get_n_thread_caches() == 1);
+}
+
+void benchmark_general_manager ()
+{
+	constexpr uint32_t n_slots = 10000;
+	const std::vector<trace_op_t> trace = build_allocation_trace(5000000, n_slots);
+
+	{
+		Mylib::Memory::GeneralManager manager;
+
+		const uint64_t ms = replay_allocation_trace(trace, n_slots,
+			[&] (const uint32_t size) { return manager.allocate(size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__); },
+			[&] (void *p, const uint32_t size) { manager.deallocate(p, size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+		);
+
+		std::cout << "\tGeneralManager: " << ms << " miliseconds" << std::endl;
+	}
+
+	{
+		Mylib::Memory::GeneralManager large_manager;
+		Mylib::Memory::PoolManager manager(256, 16);
+		manager.set_large_manager(&large_manager);
+
+		const uint64_t ms = replay_allocation_trace(trace, n_slots,
+			[&] (const uint32_t size) { return manager.allocate(size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__); },
+			[&] (void *p, const uint32_t size) { manager.deallocate(p, size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+		);
+
+		std::cout << "\tPoolManager + GeneralManager: " << ms << " miliseconds" << std::endl;
+	}
+
+	{
+		const uint64_t ms = replay_allocation_trace(trace, n_slots,
+			[] (const uint32_t size) { return malloc(size); },
+			[] (void *p, const uint32_t size) { ::free(p); }
+		);
+
+		std::cout << "\tmalloc: " << ms << " miliseconds" << std::endl;
+	}
+}
+
+// ---------------------------------------------------
+
+void test_vector ()
+{
+	Mylib::Memory::PoolManager factory(1024, 8);
+	Mylib::Memory::AllocatorSTL<uint32_t> stl_pool_allocator(factory);
+	std::vector<uint32_t, Mylib::Memory::AllocatorSTL<uint32_t>> vector(stl_pool_allocator);
+
+	// grows through single chunks, contiguous runs and malloc
+	for (uint32_t i = 0; i < 100000; i++)
+		vector.push_back(i);
+
+	uint32_t correct = 0;
+	for (uint32_t i = 0; i < vector.size(); i++) {
+		if (vector[i] == i)
+			correct++;
+	}
+
+	std::cout << correct << " elements are correct" << std::endl;
+}
+
+void test_contiguous_reuse ()
+{
+	// Arrays that don't fit in a chunk are runs of contiguous chunks.
+	// Freed runs must be reused, otherwise an alloc/free loop grows forever.
+
+	Mylib::Memory::PoolManager manager(64, 8);
+	Mylib::Memory::PoolCore *pool = manager.get_pool(8);
+
+	for (uint32_t i = 0; i < 100000; i++) {
+		void *p = manager.allocate(8, 100, 8);
+		manager.deallocate(p, 8, 100, 8);
+	}
+
+	std::cout << "\tsame length: " << pool->get_n_blocks() << " blocks" << std::endl;
+	assert(pool->get_n_blocks() == 1);
+
+	// shorter arrays are split from the longer free runs
+
+	for (uint32_t i = 0; i < 100000; i++) {
+		const uint32_t count = 9 + (i % 200);
+		void *p = manager.allocate(8, count, 8);
+		void *q = manager.allocate(8, count / 2 + 9, 8);
+		manager.deallocate(p, 8, count, 8);
+		manager.deallocate(q, 8, count / 2 + 9, 8);
+	}
+
+	std::cout << "\tmixed lengths: " << pool->get_n_blocks() << " blocks" << std::endl;
+	assert(pool->get_n_blocks() <= 2);
+
+	// growing vectors go through runs of increasing length
+
+	Mylib::Memory::AllocatorSTL<uint64_t> stl_pool_allocator(manager);
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		std::vector<uint64_t, Mylib::Memory::AllocatorSTL<uint64_t>> vector(stl_pool_allocator);
+
+		for (uint32_t j = 0; j < 1000; j++)
+			vector.push_back(j);
+	}
+
+	std::cout << "\tgrowing vectors: " << pool->get_n_blocks() << " blocks" << std::endl;
+	assert(pool->get_n_blocks() <= 2);
+
+	// the free runs can be trimmed
+
+	manager.trim();
+	std::cout << "\tafter trim: " << pool->get_n_blocks() << " blocks" << std::endl;
+	assert(pool->get_n_blocks() == 0);
+}
+
+void benchmark_bulk ()
+{
+	constexpr uint32_t n_frames = 1000;
+	constexpr uint32_t n_objs_per_frame = 10000;
+
+	Mylib::Memory::PoolManager factory(1024, 8);
+	std::vector<void*> ptrs(n_objs_per_frame);
+
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			for (void*& p : ptrs)
+				p = factory.allocate(sizeof(obj_t), 1, alignof(obj_t));
+			for (void *p : ptrs)
+				static_cast<obj_t*>(p)->a = frame;
+			for (void *p : ptrs)
+				factory.deallocate(p, sizeof(obj_t), 1, alignof(obj_t));
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		std::cout << "\tone at a time: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " miliseconds" << std::endl;
+	}
+
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			factory.allocate_bulk(ptrs, sizeof(obj_t), alignof(obj_t));
+			for (void *p : ptrs)
+				static_cast<obj_t*>(p)->a = frame;
+			factory.deallocate_bulk(ptrs, sizeof(obj_t), alignof(obj_t));
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		std::cout << "\tbulk: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " miliseconds" << std::endl;
+	}
+}
+
+// ---------------------------------------------------
+
+// signed, since the RSS may shrink between two calls
+int64_t get_rss_kb ()
+{
+	size_t pages_total, pages_resident;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (fp == nullptr)
+		return 0;
+
+	if (fscanf(fp, "%zu %zu", &pages_total, &pages_resident) != 2)
+		pages_resident = 0;
+
+	fclose(fp);
+
+	return static_cast<int64_t>(pages_resident * sysconf(_SC_PAGESIZE)) / 1024;
+}
+
+void benchmark_first_allocation ()
+{
+	// A new block is not touched when allocated,
+	// so the first allocation should not depend on the block size,
+	// and the RSS should grow only with the chunks actually used.
+
+	constexpr size_t type_size = 64;
+
+	for (const size_t block_size : { 16 * 1024, 1024 * 1024, 64 * 1024 * 1024 }) {
+		Mylib::Memory::PoolCore pool(type_size, block_size / type_size, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+		const int64_t rss_start = get_rss_kb();
+
+		auto start = std::chrono::steady_clock::now();
+		uint64_t *p = static_cast<uint64_t*>( pool.allocate() );
+		*p = 1;
+		auto end = std::chrono::steady_clock::now();
+
+		const int64_t rss_first = get_rss_kb();
+
+		for (uint32_t i = 0; i < 1000; i++)
+			*static_cast<uint64_t*>( pool.allocate() ) = i;
+
+		const int64_t rss_1000 = get_rss_kb();
+
+		std::cout << "\tblock size " << (block_size / 1024) << "KB"
+			<< " first allocation: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds"
+			<< " RSS growth after 1 allocation: " << (rss_first - rss_start) << "KB"
+			<< " after 1001 allocations: " << (rss_1000 - rss_start) << "KB" << std::endl;
+	}
+}
+
+// ---------------------------------------------------
+
+void benchmark_block_policy ()
+{
+	// long-lived pool with lots of objects
+	constexpr uint32_t n_objs = 5000000;
+
+	struct config_t {
+		const char *name;
+		Mylib::Memory::BlockPolicy policy;
+		bool reserve;
+	};
+
+	const config_t configs[] = {
+		{ "fixed", { .growth = Mylib::Memory::BlockGrowth::Fixed }, false },
+		{ "doubling", { .growth = Mylib::Memory::BlockGrowth::Doubling }, false },
+		{ "doubling + huge pages", { .growth = Mylib::Memory::BlockGrowth::Doubling, .backend = Mylib::Memory::BlockBackend::HugePages }, false },
+		{ "fixed + reserve", { .growth = Mylib::Memory::BlockGrowth::Fixed }, true },
+	};
+
+	std::vector<obj_t*> objs(n_objs);
+
+	for (const config_t& config : configs) {
+		Mylib::Memory::PoolCore pool(sizeof(obj_t), Mylib::Memory::default_block_size / sizeof(obj_t), alignof(obj_t), config.policy);
+
+		if (config.reserve)
+			pool.reserve(n_objs);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t i = 0; i < n_objs; i++) {
+			objs[i] = static_cast<obj_t*>( pool.allocate() );
+			objs[i]->a = i;
+		}
+
+		// random access, to show the TLB pressure
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < n_objs; i++)
+			sum += objs[(static_cast<uint64_t>(i) * 7919) % n_objs]->a;
+
+		for (uint32_t i = 0; i < n_objs; i++)
+			pool.deallocate(objs[i]);
+
+		auto end = std::chrono::steady_clock::now();
+
+		mylib_assert(sum == static_cast<uint64_t>(n_objs) * (n_objs - 1) / 2)
+
+		std::cout << "\t" << config.name << ": " << pool.get_n_blocks() << " blocks "
+			<< std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " miliseconds" << std::endl;
+	}
+}
+
+// ---------------------------------------------------
+
+void test_trim ()
+{
+	constexpr uint32_t n_objs = 2000000;
+
+	Mylib::Memory::PoolCore factory(sizeof(obj_t), Mylib::Memory::default_block_size / sizeof(obj_t), alignof(obj_t));
+	std::vector<obj_t*> objs(n_objs);
+
+	const int64_t rss_start = get_rss_kb();
+
+	// load spike
+
+	for (uint32_t i = 0; i < n_objs; i++) {
+		objs[i] = static_cast<obj_t*>( factory.allocate() );
+		objs[i]->a = i;
+	}
+
+	const int64_t rss_peak = get_rss_kb();
+	const uint32_t blocks_peak = factory.get_n_blocks();
+
+	// we keep every 1000th object alive, so some blocks can't be released
+
+	uint32_t n_alive = 0;
+
+	for (uint32_t i = 0; i < n_objs; i++) {
+		if ((i % 1000) == 0)
+			objs[n_alive++] = objs[i];
+		else
+			factory.deallocate(objs[i]);
+	}
+
+	// incremental trim, as it would run once per frame
+
+	uint32_t n_frames = 0;
+	uint64_t max_frame_us = 0;
+
+	while (true) {
+		auto start = std::chrono::steady_clock::now();
+		const size_t n_trimmed = factory.trim(10000);
+		auto end = std::chrono::steady_clock::now();
+
+		const uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+		if (us > max_frame_us)
+			max_frame_us = us;
+
+		n_frames++;
+
+		if (n_trimmed < 10000)
+			break;
+	}
+
+	// blocks are released to malloc, which may keep them in its own free lists
+	malloc_trim(0);
+
+	const int64_t rss_trim = get_rss_kb();
+
+	uint32_t correct = 0;
+	for (uint32_t i = 0; i < n_alive; i++) {
+		if (objs[i]->a == (i * 1000))
+			correct++;
+	}
+
+	std::cout << correct << " elements are correct" << std::endl;
+	std::cout << "\tpeak: " << blocks_peak << " blocks RSS growth " << (rss_peak - rss_start) << "KB" << std::endl;
+	std::cout << "\tafter trim: " << factory.get_n_blocks() << " blocks RSS growth " << (rss_trim - rss_start) << "KB" << std::endl;
+	std::cout << "\tincremental trim: " << n_frames << " frames, max " << max_frame_us << " microseconds per frame" << std::endl;
+
+	// memory kept by trim must still be usable
+
+	for (uint32_t i = n_alive; i < n_objs; i++) {
+		objs[i] = static_cast<obj_t*>( factory.allocate() );
+		objs[i]->a = i * 1000;
+	}
+
+	for (uint32_t i = 0; i < n_objs; i++)
+		factory.deallocate(objs[i]);
+
+	factory.shrink_to_fit();
+	malloc_trim(0);
+
+	std::cout << "\tafter freeing everything and shrink_to_fit: " << factory.get_n_blocks() << " blocks RSS growth " << (get_rss_kb() - rss_start) << "KB" << std::endl;
+}
+
+#ifdef MYLIB_MEMORY_STATS
+void test_stats ()
+{
+	Mylib::Memory::PoolManager manager({ 16, 32, 64 });
+	std::vector<void*> ptrs;
+
+	// 20 of them don't fit exactly in their size class
+	for (uint32_t i = 0; i < 100; i++)
+		ptrs.push_back(manager.allocate(((i % 5) == 0) ? 20 : 32, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__));
+
+	void *large = manager.allocate(1000, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	void *array = manager.allocate(16, 3, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	for (uint32_t i = 0; i < 50; i++)
+		manager.deallocate(ptrs[i], ((i % 5) == 0) ? 20 : 32, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	Mylib::Memory::Stats stats = manager.get_stats();
+
+	stats.dump_text(std::cout);
+	stats.dump_json(std::cout);
+	std::cout << std::endl;
+
+	// 10 alive chunks of 32 bytes storing 20 bytes + a chunk of 64 bytes storing 16*3
+	assert(stats.internal_fragmentation() == (10 * 12 + 16));
+	assert(stats.fallback.n_allocations == 1);
+	assert(stats.total.peak_bytes == (100 * 32 + 1000 + 64));
+	assert(stats.total.current_bytes == (50 * 32 + 1000 + 64));
+
+	manager.deallocate(large, 1000, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	manager.deallocate(array, 16, 3, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	for (uint32_t i = 50; i < 100; i++)
+		manager.deallocate(ptrs[i], ((i % 5) == 0) ? 20 : 32, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	stats = manager.get_stats();
+
+	assert(stats.total.current_bytes == 0);
+	assert(stats.requested_bytes == 0);
+	assert(stats.total.n_allocations == stats.total.n_deallocations);
+
+	std::cout << "stats are correct" << std::endl;
+}
+#endif
+
+template <typename Tfunc>
+bool check_fails (Tfunc func)
+{
+	try {
+		func();
+	}
+	catch (const Mylib::Exception&) {
+		return true;
+	}
+
+	return false;
+}
+
+using ProfiledSizeClasses = Mylib::Memory::SizeClassTable<24, 40, 72, 136>;
+
+void test_size_profile ()
+{
+	Mylib::Memory::SizeProfile profile;
+
+	// sizes just above the steps of 16 bytes
+	profile.record(17, 1000);
+	profile.record(24, 500);
+	profile.record(33, 1000);
+	profile.record(40, 100);
+	profile.record(65, 1000);
+	profile.record(72, 10);
+	profile.record(129, 1000);
+	profile.record(5000, 10); // ignored, larger than max_type_size
+
+	std::vector<size_t> classes = profile.build_size_classes(4, 256);
+
+	Mylib::Memory::SizeProfile::dump_size_class_table(std::cout, "ProfiledSizeClasses", classes);
+
+	assert(classes.size() == 4);
+
+	for (size_t i = 0; i < classes.size(); i++)
+		assert(classes[i] == ProfiledSizeClasses::size_classes[i]);
+
+	static_assert(ProfiledSizeClasses::index[17] == 0);
+	static_assert(ProfiledSizeClasses::index[25] == 1);
+	static_assert(ProfiledSizeClasses::index[136] == 3);
+
+	Mylib::Memory::PoolManager from_profile(profile, 4, 256);
+	Mylib::Memory::PoolManager from_table(ProfiledSizeClasses{});
+
+	// the sizes between the largest recorded one and max_type_size still go to the pools
+	assert(from_profile.get_max_type_size() == 256);
+
+	assert(check_fails([&profile] () { return profile.build_size_classes(0, 256); }));
+
+	for (Mylib::Memory::Manager *manager : { static_cast<Mylib::Memory::Manager*>(&from_profile), static_cast<Mylib::Memory::Manager*>(&from_table) }) {
+		std::vector<uint8_t*> ptrs;
+
+		for (size_t size = 1; size <= 300; size++) {
+			uint8_t *p = static_cast<uint8_t*>( manager->allocate(size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__) );
+			memset(p, static_cast<int>(size), size);
+			ptrs.push_back(p);
+		}
+
+		for (size_t size = 1; size <= 300; size++) {
+			uint8_t *p = ptrs[size - 1];
+
+			for (size_t i = 0; i < size; i++)
+				assert(p[i] == static_cast<uint8_t>(size));
+
+			manager->deallocate(p, size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+		}
+	}
+
+#ifdef MYLIB_MEMORY_STATS
+	for (const auto& [type_size, count] : profile.get_histogram())
+		from_table.deallocate(from_table.allocate(type_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__), type_size, 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+
+	// the profile recorded by the manager during this test
+	Mylib::Memory::SizeProfile::dump_size_class_table(std::cout, "RecordedSizeClasses", from_table.get_size_profile().build_size_classes(4, 256));
+#endif
+
+	// More buckets than classes, so the sizes must really be merged.
+	// Picking the most frequent sizes (8, 16, 40) is not the best answer here.
+
+	Mylib::Memory::SizeProfile merge_profile;
+	merge_profile.record(8, 100);
+	merge_profile.record(16, 60);
+	merge_profile.record(24, 50);
+	merge_profile.record(32, 1);
+	merge_profile.record(40, 100);
+
+	// bytes wasted by rounding the recorded sizes up to their size class
+	auto wasted_bytes = [&merge_profile] (const std::vector<size_t>& classes) -> uint64_t {
+		uint64_t waste = 0;
+
+		for (const auto& [type_size, count] : merge_profile.get_histogram())
+			waste += (*std::lower_bound(classes.begin(), classes.end(), type_size) - type_size) * count;
+
+		return waste;
+	};
+
+	// checked by hand against all the possible choices
+	const std::vector<size_t> best_3 = { 8, 24, 40 }; // 60 * 8 + 1 * 8
+	const std::vector<size_t> best_2 = { 16, 40 };    // 100 * 8 + 50 * 16 + 1 * 8
+
+	std::vector<size_t> merged_3 = merge_profile.build_size_classes(3, 256);
+	std::vector<size_t> merged_2 = merge_profile.build_size_classes(2, 256);
+
+	std::cout << "\t3 classes waste " << wasted_bytes(merged_3) << " bytes, 2 classes waste " << wasted_bytes(merged_2) << " bytes" << std::endl;
+
+	assert(merged_3 == best_3);
+	assert(wasted_bytes(merged_3) == 488);
+	assert(wasted_bytes({ 8, 16, 40 }) == 808);
+
+	assert(merged_2 == best_2);
+	assert(wasted_bytes(merged_2) == 1608);
+
+	std::cout << "size classes are correct" << std::endl;
+}
+
+using StaticManager = Mylib::Memory::StaticPoolManager<8, 16, 32, 64, 128>;
+
+struct big_obj_t {
+	uint64_t data[40];
+};
+
+void test_static_pool_manager ()
+{
+	StaticManager manager;
+
+	static_assert(StaticManager::Table::index[sizeof(obj_t)] == 2);
+
+	// typed allocations take the compile-time path
+
+	obj_t *obj = manager.allocate_construct_type<obj_t>();
+	obj->a = 1;
+
+	big_obj_t *big = manager.allocate_type<big_obj_t>(); // larger than the classes, goes to malloc
+	big->data[39] = 2;
+
+	assert(&manager.get_pool<sizeof(obj_t)>() == &manager.get_pool<32>());
+
+	// type-erased callers use the runtime interface
+
+	std::vector<uint32_t, Mylib::Memory::AllocatorSTL<uint32_t>> v(manager);
+
+	for (uint32_t i = 0; i < 1000; i++)
+		v.push_back(i);
+
+	for (uint32_t i = 0; i < 1000; i++)
+		assert(v[i] == i);
+
+	Mylib::Memory::Manager& erased = manager;
+	obj_t *obj2 = erased.allocate_type<obj_t>(1);
+	obj2->a = 3;
+
+	// memory allocated by one path can be freed by the other
+	manager.destruct_deallocate_type(obj);
+	manager.deallocate_type(obj2);
+	erased.deallocate_type(big, 1);
+
+	std::cout << "static pool manager is correct" << std::endl;
+}
+
+void benchmark_static_pool_manager ()
+{
+	constexpr uint32_t n_frames = 1000;
+	constexpr uint32_t n_objs_per_frame = 10000;
+
+	std::vector<obj_t*> ptrs(n_objs_per_frame);
+
+	auto run = [&] (auto& manager) -> int64_t {
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			for (obj_t*& p : ptrs)
+				p = manager.template allocate_type<obj_t>(1);
+			for (obj_t *p : ptrs)
+				p->a = frame;
+			for (obj_t *p : ptrs)
+				manager.template deallocate_type<obj_t>(p, 1);
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	{
+		Mylib::Memory::PoolManager manager(128, 8);
+		Mylib::Memory::Manager *volatile erased = &manager; // so the compiler can't devirtualize
+		std::cout << "\tPoolManager: " << run(*erased) << " miliseconds" << std::endl;
+	}
+
+	{
+		StaticManager manager;
+		Mylib::Memory::Manager *volatile erased = &manager;
+		std::cout << "\tStaticPoolManager through Manager&: " << run(*erased) << " miliseconds" << std::endl;
+	}
+
+	{
+		StaticManager manager;
+		std::cout << "\tStaticPoolManager typed: " << run(manager) << " miliseconds" << std::endl;
+	}
+}
+
+void test_arena ()
+{
+	Mylib::Memory::ArenaManager arena(256);
+
+	// more than the first buffer, so we go through the chain
+	std::vector<obj_t*> objs;
+
+	for (uint32_t i = 0; i < 1000; i++) {
+		obj_t *obj = arena.allocate_type<obj_t>(1);
+		assert((reinterpret_cast<uintptr_t>(obj) % alignof(obj_t)) == 0);
+		obj->a = i;
+		objs.push_back(obj);
+	}
+
+	for (uint32_t i = 0; i < 1000; i++)
+		assert(objs[i]->a == i);
+
+	{
+		Mylib::Memory::ArenaManager::Scope scope(arena);
+
+		std::vector<uint32_t, Mylib::Memory::AllocatorSTL<uint32_t>> v(arena);
+
+		for (uint32_t i = 0; i < 10000; i++)
+			v.push_back(i);
+
+		for (uint32_t i = 0; i < 10000; i++)
+			assert(v[i] == i);
+
+		auto ptr = Mylib::Memory::make_unique<obj_t>(arena);
+		ptr->a = 5;
+	}
+
+	// the scope released only what was allocated inside it
+	obj_t *after_scope = arena.allocate_type<obj_t>(1);
+	assert(after_scope == objs.back() + 1);
+
+	arena.reset();
+
+	// after reset, we start from the first buffer again
+	assert(arena.allocate_type<obj_t>(1) != nullptr);
+
+	std::cout << "arena is correct" << std::endl;
+}
+
+void benchmark_arena ()
+{
+	constexpr uint32_t n_frames = 1000;
+	constexpr uint32_t n_objs_per_frame = 10000;
+
+	// per-frame temporaries of mixed sizes, all released at the end of the frame
+
+	std::vector<void*> ptrs(n_objs_per_frame);
+	std::vector<size_t> sizes(n_objs_per_frame);
+	std::mt19937 rng(1);
+
+	for (size_t& size : sizes)
+		size = 16 + (rng() % 240);
+
+	auto run = [&] (Mylib::Memory::Manager& manager, auto end_frame) -> int64_t {
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t frame = 0; frame < n_frames; frame++) {
+			for (uint32_t i = 0; i < n_objs_per_frame; i++) {
+				ptrs[i] = manager.allocate(sizes[i], 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+				*static_cast<uint32_t*>(ptrs[i]) = frame;
+			}
+
+			end_frame();
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	auto free_all = [&] (Mylib::Memory::Manager& manager) {
+		for (uint32_t i = 0; i < n_objs_per_frame; i++)
+			manager.deallocate(ptrs[i], sizes[i], 1, __STDCPP_DEFAULT_NEW_ALIGNMENT__);
+	};
+
+	{
+		Mylib::Memory::ArenaManager arena;
+		std::cout << "\tArenaManager: " << run(arena, [&] () { arena.reset(); }) << " miliseconds" << std::endl;
+	}
+
+	{
+		Mylib::Memory::PoolManager manager(256, 16);
+		std::cout << "\tPoolManager: " << run(manager, [&] () { free_all(manager); }) << " miliseconds" << std::endl;
+	}
+
+	{
+		Mylib::Memory::DefaultManager manager;
+		std::cout << "\tDefaultManager: " << run(manager, [&] () { free_all(manager); }) << " miliseconds" << std::endl;
+	}
+}
+
+void benchmark_devirtualized ()
+{
+	constexpr uint32_t n_rounds = 100;
+	constexpr uint32_t n_elements = 100000;
+
+	auto run_list = [&] (auto allocator) -> int64_t {
+		using Tlist = std::list<uint32_t, decltype(allocator)>;
+		Tlist list(allocator);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t round = 0; round < n_rounds; round++) {
+			for (uint32_t i = 0; i < n_elements; i++)
+				list.push_back(i);
+			list.clear();
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	auto run_unique_ptr = [&] (auto make) -> int64_t {
+		[[maybe_unused]] obj_t *volatile sink; // otherwise the compiler may remove the allocation
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t round = 0; round < n_rounds; round++) {
+			for (uint32_t i = 0; i < n_elements; i++) {
+				auto ptr = make();
+				ptr->a = i;
+				sink = ptr.get();
+			}
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	Mylib::Memory::PoolManager manager(1024, 8);
+	Mylib::Memory::Manager *volatile erased = &manager; // so the compiler can't devirtualize
+
+	std::cout << "\tstd::list AllocatorSTL<T>: " << run_list(Mylib::Memory::AllocatorSTL<uint32_t>(*erased)) << " miliseconds" << std::endl;
+	std::cout << "\tstd::list AllocatorSTL<T, PoolManager>: " << run_list(Mylib::Memory::AllocatorSTL<uint32_t, Mylib::Memory::PoolManager>(manager)) << " miliseconds" << std::endl;
+
+	std::cout << "\tunique_ptr<T>: " << run_unique_ptr([&] () { return Mylib::Memory::make_unique<obj_t>(*erased); }) << " miliseconds" << std::endl;
+	std::cout << "\tunique_ptr<T, PoolManager>: " << run_unique_ptr([&] () { return Mylib::Memory::make_unique_static<obj_t>(manager); }) << " miliseconds" << std::endl;
+
+	StaticManager static_manager;
+	std::cout << "\tunique_ptr<T, StaticPoolManager>: " << run_unique_ptr([&] () { return Mylib::Memory::make_unique_static<obj_t>(static_manager); }) << " miliseconds" << std::endl;
+}
+
+// counts the live bytes, to check that deallocate receives the same size of allocate
+class CheckedManager : public Mylib::Memory::Manager
+{
+public:
+	size_t live_bytes = 0;
+	uint32_t n_live = 0;
+
+	[[nodiscard]] void* allocate (const size_t type_size, const size_t count, const size_t align) override final
+	{
+		this->live_bytes += type_size * count;
+		this->n_live++;
+		return Mylib::Memory::m_allocate(type_size * count, align);
+	}
+
+	void deallocate (void *p, const size_t type_size, const size_t count, const size_t align) override final
+	{
+		this->live_bytes -= type_size * count;
+		this->n_live--;
+		Mylib::Memory::m_deallocate(p, type_size * count, align);
+	}
+};
+
+struct base_a_t {
+	uint64_t a = 1;
+	virtual ~base_a_t () = default;
+};
+
+struct base_b_t {
+	uint64_t b = 2;
+	virtual ~base_b_t () = default;
+};
+
+struct alignas(64) multi_derived_t : public base_a_t, public base_b_t {
+	uint64_t c[10];
+	uint32_t *destroyed;
+
+	multi_derived_t (uint32_t *destroyed_)
+		: destroyed(destroyed_)
+	{
+	}
+
+	~multi_derived_t ()
+	{
+		(*this->destroyed)++;
+	}
+};
+
+void test_compact_unique_ptr ()
+{
+	CheckedManager manager;
+	uint32_t destroyed = 0;
+
+	static_assert(sizeof(Mylib::Memory::compact_unique_ptr<base_b_t>) == sizeof(void*));
+
+	{
+		// base_b_t is not at the beginning of the object
+		Mylib::Memory::compact_unique_ptr<base_b_t> ptr = Mylib::Memory::make_compact_unique<multi_derived_t>(manager, &destroyed);
+		assert(ptr->b == 2);
+		assert((reinterpret_cast<uintptr_t>(dynamic_cast<multi_derived_t*>(ptr.get())) % 64) == 0);
+
+		Mylib::Memory::compact_unique_ptr<obj_t> obj = Mylib::Memory::make_compact_unique<obj_t>(manager);
+		obj->a = 1;
+
+		assert(manager.n_live == 2);
+	}
+
+	assert(destroyed == 1);
+	assert(manager.n_live == 0);
+	assert(manager.live_bytes == 0);
+
+	{
+		Mylib::Memory::unique_ptr<base_a_t> ptr = Mylib::Memory::make_unique<multi_derived_t>(manager, &destroyed);
+	}
+
+	assert(destroyed == 2);
+	assert(manager.live_bytes == 0);
+
+	std::cout << "sizeof(unique_ptr) " << sizeof(Mylib::Memory::unique_ptr<obj_t>)
+		<< " sizeof(compact_unique_ptr) " << sizeof(Mylib::Memory::compact_unique_ptr<obj_t>) << std::endl;
+	std::cout << "compact unique_ptr is correct" << std::endl;
+}
+
+void test_sizeless_deallocate ()
+{
+	Mylib::Memory::PoolManager manager(256, 16, Mylib::Memory::default_block_size, Mylib::Memory::BlockPolicy {
+		.backend = Mylib::Memory::BlockBackend::Segments
+	});
+
+	std::vector<std::pair<void*, size_t>> ptrs;
+
+	for (uint32_t i = 0; i < 100000; i++) {
+		const size_t size = 1 + (i * 7) % 300;
+		void *p = manager.allocate(size, 1, 8);
+		std::memset(p, 0xFF, size);
+		ptrs.push_back({p, size});
+
+		Mylib::Memory::PoolCore *pool = Mylib::Memory::segment_map.find(p);
+
+		if (size <= 256)
+			assert(pool != nullptr && pool->get_chunk_size() >= size);
+		else
+			assert(pool == nullptr);
+	}
+
+	void *p_malloc = std::malloc(64);
+	assert(Mylib::Memory::segment_map.find(p_malloc) == nullptr);
+	std::free(p_malloc);
+
+	int on_stack;
+	assert(Mylib::Memory::segment_map.find(&on_stack) == nullptr);
+
+	void *p_pool = ptrs.front().first;
+
+	for (auto& [p, size] : ptrs)
+		manager.deallocate(p);
+
+	// the blocks are released and removed from the segment map
+	manager.shrink_to_fit();
+	assert(Mylib::Memory::segment_map.find(p_pool) == nullptr);
+
+	// With the default BlockBackend::Heap, the pools can't be found,
+	// so the chunk would be passed to operator delete.
+
+	{
+		Mylib::Memory::PoolManager heap_manager(256, 16);
+		void *p = heap_manager.allocate(32, 1, 16);
+
+		assert(check_fails([&] () { heap_manager.deallocate(p); }));
+		heap_manager.deallocate(p, 32, 1, 16);
+	}
+
+	// The size of a chunk of the large_manager is unknown.
+
+	{
+		Mylib::Memory::GeneralManager large_manager;
+		manager.set_large_manager(&large_manager);
+
+		void *p = manager.allocate(1000, 1, 8);
+
+		assert(check_fails([&] () { manager.deallocate(p); }));
+		manager.deallocate(p, 1000, 1, 8);
+
+		manager.set_large_manager(nullptr);
+	}
+
+	std::cout << "sizeless deallocate is correct" << std::endl;
+}
+
+void test_checked_pool ()
+{
+	using Mylib::Memory::CheckedPoolCore;
+	using Mylib::Memory::CheckedPoolManager;
+	using Mylib::Memory::PoolNoChecks;
+
+	static_assert(std::is_empty_v<Mylib::Memory::PoolChecker<PoolNoChecks>>);
+	static_assert(Mylib::Memory::PoolChecker<PoolNoChecks>::chunk_size(24, 8) == 24);
+
+	CheckedPoolCore<> pool(24, 64, 8);
+	CheckedPoolCore<> other_pool(24, 64, 8);
+
+	// regular use must not trigger any check
+	{
+		std::vector<uint8_t*> ptrs;
+
+		for (uint32_t round = 0; round < 3; round++) {
+			for (uint32_t i = 0; i < 1000; i++) {
+				uint8_t *p = static_cast<uint8_t*>(pool.allocate());
+				std::memset(p, static_cast<int>(i), 24);
+				ptrs.push_back(p);
+			}
+
+			for (uint8_t *p : ptrs)
+				pool.deallocate(p);
+
+			ptrs.clear();
+		}
+
+		pool.shrink_to_fit();
+	}
+
+	uint8_t *p = static_cast<uint8_t*>(pool.allocate());
+	pool.deallocate(p);
+	assert(check_fails([&] () { pool.deallocate(p); }));
+
+	p = static_cast<uint8_t*>(pool.allocate());
+	assert(check_fails([&] () { other_pool.deallocate(p); }));
+
+	int on_stack;
+	assert(check_fails([&] () { pool.deallocate(&on_stack); }));
+
+	p[24] = 0; // one byte past the object
+	assert(check_fails([&] () { pool.deallocate(p); }));
+
+#if !defined(MYLIB_MEMORY_ASAN)
+	// with ASan, the write itself is reported
+	p = static_cast<uint8_t*>(pool.allocate());
+	pool.deallocate(p);
+	p[10] = 0;
+	assert(check_fails([&] () { for (uint32_t i = 0; i < 64; i++) { [[maybe_unused]] void *q = pool.allocate(); } }));
+#endif
+
+	CheckedPoolManager<> manager(256, 8);
+
+	{
+		auto ptr = Mylib::Memory::make_unique<obj_t>(manager);
+		ptr->a = 1;
+
+		std::vector<int, Mylib::Memory::AllocatorSTL<int>> v(manager);
+
+		for (int i = 0; i < 1000; i++)
+			v.push_back(i);
+	}
+
+	void *q = manager.allocate(16, 1, 8);
+	assert(check_fails([&] () { manager.deallocate(q, 200, 1, 8); }));
+	manager.deallocate(q, 16, 1, 8);
+	assert(check_fails([&] () { manager.deallocate(q, 16, 1, 8); }));
+
+	std::cout << "checked pools are correct" << std::endl;
+}
+
+void test_aligned_size_classes ()
+{
+	using Mylib::Memory::cache_line_size;
+
+	Mylib::Memory::PoolManager manager({{16, cache_line_size}, {24}, {100, 32}});
+
+	assert(manager.get_pool(10)->get_chunk_size() == cache_line_size);
+	assert(manager.get_pool(20)->get_chunk_size() == 32); // 24 padded to the default alignment
+	assert(manager.get_pool(100)->get_chunk_size() == 128);
+
+	void *a = manager.allocate(16, 1, 8);
+	void *b = manager.allocate(16, 1, 8);
+	void *c = manager.allocate(100, 1, 8);
+
+	assert((reinterpret_cast<uintptr_t>(a) % cache_line_size) == 0);
+	assert((reinterpret_cast<uintptr_t>(b) % cache_line_size) == 0);
+	assert((reinterpret_cast<uintptr_t>(c) % 32) == 0);
+
+	manager.deallocate(a, 16, 1, 8);
+	manager.deallocate(b, 16, 1, 8);
+	manager.deallocate(c, 100, 1, 8);
+
+	// plain sizes are not padded
+	Mylib::Memory::PoolManager natural(64, 8);
+	assert(natural.get_pool(24)->get_chunk_size() == 24);
+
+	// ConcurrentPoolCore pads the chunks the same way as PoolCore
+
+	Mylib::Memory::ConcurrentPoolCore concurrent(24, 64, 16);
+	std::vector<void*> concurrent_ptrs;
+	assert(concurrent.get_chunk_size() == 32);
+
+	for (uint32_t i = 0; i < 200; i++) {
+		void *p = concurrent.allocate();
+		assert((reinterpret_cast<uintptr_t>(p) % 16) == 0);
+		concurrent_ptrs.push_back(p);
+	}
+
+	for (void *p : concurrent_ptrs)
+		concurrent.deallocate(p);
+
+	// block coloring: the first chunk of each block moves one cache line
+
+	Mylib::Memory::PoolCore pool(64, 16, 64, Mylib::Memory::BlockPolicy {
+		.backend = Mylib::Memory::BlockBackend::Segments,
+		.n_colors = 4
+	});
+
+	std::vector<void*> ptrs;
+	std::vector<size_t> first_offsets;
+	uintptr_t segment = 0;
+
+	for (uint32_t i = 0; i < 10000; i++) {
+		void *p = pool.allocate();
+		ptrs.push_back(p);
+
+		const uintptr_t address = reinterpret_cast<uintptr_t>(p);
+
+		if ((address & ~(Mylib::Memory::segment_size - 1)) != segment) {
+			segment = address & ~(Mylib::Memory::segment_size - 1);
+			first_offsets.push_back(address - segment);
+		}
+	}
+
+	assert(first_offsets.size() > 4);
+
+	for (size_t i = 1; i < first_offsets.size(); i++)
+		assert(first_offsets[i] == first_offsets[0] + (i % 4) * cache_line_size);
+
+	for (void *p : ptrs)
+		pool.deallocate(p);
+
+	std::cout << "aligned size classes are correct" << std::endl;
+}
+
+void benchmark_false_sharing ()
+{
+	using Mylib::Memory::cache_line_size;
+
+	// Each thread gets an object from the same pool and keeps writing to it.
+	// Without padding, the objects of neighbour threads share a cache line.
+
+	const uint32_t n_writers = std::max(4u, std::thread::hardware_concurrency());
+	constexpr uint64_t n_writes = 50000000;
+
+	struct counter_t {
+		uint64_t value;
+	};
+
+	auto run = [&] (Mylib::Memory::Manager& manager) -> int64_t {
+		std::vector<counter_t*> counters;
+		std::vector<std::thread> threads;
+
+		for (uint32_t i = 0; i < n_writers; i++)
+			counters.push_back(manager.template allocate_construct_type<counter_t>());
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t i = 0; i < n_writers; i++) {
+			threads.emplace_back([counter = counters[i]] () {
+				volatile uint64_t *value = &counter->value;
+
+				for (uint64_t j = 0; j < n_writes; j++)
+					*value = *value + 1;
+			});
+		}
+
+		for (auto& thread : threads)
+			thread.join();
+
+		auto end = std::chrono::steady_clock::now();
+
+		for (counter_t *counter : counters) {
+			assert(counter->value == n_writes);
+			manager.template destruct_deallocate_type<counter_t>(counter);
+		}
+
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	Mylib::Memory::PoolManager packed({8, 16, 32, 64});
+	Mylib::Memory::PoolManager padded({{8, cache_line_size}, {16, cache_line_size}, {32, cache_line_size}, {64, cache_line_size}});
+
+	std::cout << "\t" << n_writers << " threads, " << n_writes << " writes each" << std::endl;
+	std::cout << "\tpacked chunks: " << run(packed) << " miliseconds" << std::endl;
+	std::cout << "\tcache line aligned chunks: " << run(padded) << " miliseconds" << std::endl;
+}
+
+void test_numa ()
+{
+	const uint32_t n_nodes = Mylib::Memory::get_numa_n_nodes();
+	const uint32_t current_node = Mylib::Memory::get_numa_current_node();
+
+	std::cout << "\tnodes " << n_nodes << " current node " << current_node << std::endl;
+	assert(current_node < n_nodes);
+
+#if defined(__linux__)
+	// the pages of the blocks must have our policy,
+	// including the first page of a segment, where the block header is written
+
+	auto check_policy = [current_node] (const void *addr) {
+		int policy = -1;
+		unsigned long nodemask[16] = {};
+
+		if (syscall(SYS_get_mempolicy, &policy, nodemask, sizeof(nodemask) * 8, addr, MPOL_F_ADDR) == 0) {
+			std::cout << "\tblock policy " << policy << " nodemask " << nodemask[0] << std::endl;
+			assert(policy == MPOL_PREFERRED);
+			assert(nodemask[0] == (1ul << current_node));
+		}
+		else
+			std::cout << "\tget_mempolicy not supported by the kernel" << std::endl;
+	};
+
+	for (const auto backend : { Mylib::Memory::BlockBackend::Segments, Mylib::Memory::BlockBackend::Heap }) {
+		Mylib::Memory::PoolCore pool(64, 1024, 64, Mylib::Memory::BlockPolicy {
+			.backend = backend,
+			.numa = Mylib::Memory::NumaBinding::Node,
+			.numa_node = current_node
+		});
+
+		void *p = pool.allocate();
+		std::memset(p, 0, 64);
+
+		check_policy(p);
+
+		if (backend == Mylib::Memory::BlockBackend::Segments)
+			check_policy( reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(p) & ~(Mylib::Memory::segment_size - 1)) );
+
+		pool.deallocate(p);
+	}
+#endif
+
+	Mylib::Memory::NumaPoolManager manager(256, 16);
+	assert(manager.get_n_nodes() == n_nodes);
+
+	// each thread frees the objects allocated by the previous one,
+	// which may be on another node
+
+	constexpr uint32_t n_numa_threads = 4;
+	constexpr uint32_t n_objs = 10000;
+
+	std::vector<std::vector<void*>> ptrs(n_numa_threads);
+	std::vector<std::thread> threads;
+
+	for (uint32_t t = 0; t < n_numa_threads; t++) {
+		threads.emplace_back([&manager, &ptrs, t] () {
+			for (uint32_t i = 0; i < n_objs; i++) {
+				const size_t size = 1 + (i % 256);
+				void *p = manager.allocate(size, 1, 8);
+				std::memset(p, 0xFF, size);
+				ptrs[t].push_back(p);
+			}
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	threads.clear();
+
+	for (uint32_t t = 0; t < n_numa_threads; t++) {
+		threads.emplace_back([&manager, &ptrs, t] () {
+			auto& list = ptrs[(t + 1) % n_numa_threads];
+
+			for (uint32_t i = 0; i < n_objs; i++)
+				manager.deallocate(list[i], 1 + (i % 256), 1, 8);
+		});
+	}
+
+	for (auto& thread : threads)
+		thread.join();
+
+	manager.trim();
+
+	for (uint32_t node = 0; node < n_nodes; node++)
+		assert(manager.get_node_manager(node).get_pool(8)->get_n_blocks() == 0);
+
+	std::cout << "numa is correct" << std::endl;
+}
+
+void test_pmr ()
+{
+	Mylib::Memory::PoolManager pool_manager(256, 8);
+	Mylib::Memory::ManagerMemoryResource pool_resource(pool_manager);
+
+	{
+		std::pmr::vector<int> v(&pool_resource);
+		std::pmr::list<obj_t> list(&pool_resource);
+		std::pmr::map<int, std::pmr::string> map(&pool_resource);
+
+		for (int i = 0; i < 10000; i++) {
+			v.push_back(i);
+			list.push_back(obj_t());
+			map.emplace(i, std::to_string(i) + " a string that doesn't fit in the small buffer");
+		}
+
+		for (int i = 0; i < 10000; i++)
+			assert(v[i] == i);
+
+		assert(map[500] == "500 a string that doesn't fit in the small buffer");
+
+		struct alignas(64) aligned_t {
+			uint8_t data[64];
+		};
+
+		std::pmr::vector<aligned_t> aligned(10, &pool_resource);
+		assert((reinterpret_cast<uintptr_t>(aligned.data()) % 64) == 0);
+	}
+
+	// ConcurrentPoolManager doesn't accept count > 1, but pmr only requests bytes
+
+	Mylib::Memory::ConcurrentPoolManager concurrent_manager(256, 8);
+	Mylib::Memory::ManagerMemoryResource concurrent_resource(concurrent_manager);
+
+	{
+		std::pmr::vector<uint64_t> v(&concurrent_resource);
+
+		for (uint64_t i = 0; i < 1000; i++)
+			v.push_back(i);
+	}
+
+	assert(pool_resource.is_equal(pool_resource));
+	assert(!pool_resource.is_equal(concurrent_resource));
+
+	// and the other way around
+
+	std::pmr::monotonic_buffer_resource monotonic;
+	Mylib::Memory::MemoryResourceManager monotonic_manager(&monotonic);
+
+	{
+		Mylib::Memory::AllocatorSTL<uint32_t> allocator(monotonic_manager);
+		std::vector<uint32_t, Mylib::Memory::AllocatorSTL<uint32_t>> v(allocator);
+
+		for (uint32_t i = 0; i < 1000; i++)
+			v.push_back(i);
+
+		auto ptr = Mylib::Memory::make_unique<obj_t>(monotonic_manager);
+		ptr->a = 1;
+	}
+
+	std::cout << "pmr bridge is correct" << std::endl;
+}
+
+void benchmark_pmr ()
+{
+	// node containers with many small objects, and vectors that keep growing
+
+	constexpr uint32_t n_rounds = 100;
+	constexpr uint32_t n_objs = 20000;
+
+	auto run = [] (std::pmr::memory_resource *resource) -> int64_t {
+		auto start = std::chrono::steady_clock::now();
+
+		for (uint32_t round = 0; round < n_rounds; round++) {
+			std::pmr::list<obj_t> list(resource);
+			std::pmr::map<uint32_t, uint64_t> map(resource);
+			std::pmr::vector<uint32_t> v(resource);
+
+			for (uint32_t i = 0; i < n_objs; i++) {
+				list.push_back(obj_t());
+				map.emplace((i * 7919) % n_objs, i);
+				v.push_back(i);
+			}
+
+			for (auto it = list.begin(); it != list.end(); ) {
+				it = list.erase(it);
+
+				if (it != list.end())
+					++it;
+			}
+		}
+
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+	};
+
+	{
+		std::pmr::unsynchronized_pool_resource resource;
+		std::cout << "\tstd::pmr::unsynchronized_pool_resource: " << run(&resource) << " miliseconds" << std::endl;
+	}
+
+	{
+		Mylib::Memory::PoolManager manager(256, 8);
+		Mylib::Memory::ManagerMemoryResource resource(manager);
+		std::cout << "\tPoolManager: " << run(&resource) << " miliseconds" << std::endl;
+	}
+
+	std::cout << "\tstd::pmr::new_delete_resource: " << run(std::pmr::new_delete_resource()) << " miliseconds" << std::endl;
+}
+
 int main ()
 {
+	std::cout << "---------------------------------- pmr start" << std::endl;
+	test_pmr();
+	benchmark_pmr();
+	std::cout << "---------------------------------- pmr end" << std::endl;
+
+	std::cout << "---------------------------------- numa start" << std::endl;
+	test_numa();
+	std::cout << "---------------------------------- numa end" << std::endl;
+
+	std::cout << "---------------------------------- aligned size classes start" << std::endl;
+	test_aligned_size_classes();
+	benchmark_false_sharing();
+	std::cout << "---------------------------------- aligned size classes end" << std::endl;
+
+	std::cout << "---------------------------------- checked pool start" << std::endl;
+	test_checked_pool();
+	std::cout << "---------------------------------- checked pool end" << std::endl;
+
+	std::cout << "---------------------------------- sizeless deallocate start" << std::endl;
+	test_sizeless_deallocate();
+	std::cout << "---------------------------------- sizeless deallocate end" << std::endl;
+
+	std::cout << "---------------------------------- compact unique_ptr start" << std::endl;
+	test_compact_unique_ptr();
+	std::cout << "---------------------------------- compact unique_ptr end" << std::endl;
+
+	std::cout << "---------------------------------- devirtualized start" << std::endl;
+	benchmark_devirtualized();
+	std::cout << "---------------------------------- devirtualized end" << std::endl;
+
+	std::cout << "---------------------------------- arena start" << std::endl;
+	test_arena();
+	benchmark_arena();
+	std::cout << "---------------------------------- arena end" << std::endl;
+
+	std::cout << "---------------------------------- static pool manager start" << std::endl;
+	test_static_pool_manager();
+	benchmark_static_pool_manager();
+	std::cout << "---------------------------------- static pool manager end" << std::endl;
+
+	std::cout << "---------------------------------- size profile start" << std::endl;
+	test_size_profile();
+	std::cout << "---------------------------------- size profile end" << std::endl;
+
+#ifdef MYLIB_MEMORY_STATS
+	std::cout << "---------------------------------- stats start" << std::endl;
+	test_stats();
+	std::cout << "---------------------------------- stats end" << std::endl;
+#endif
+
+	std::cout << "---------------------------------- trim start" << std::endl;
+	test_trim();
+	std::cout << "---------------------------------- trim end" << std::endl;
+
+	std::cout << "---------------------------------- block policy start" << std::endl;
+	benchmark_block_policy();
+	std::cout << "---------------------------------- block policy end" << std::endl;
+
+	std::cout << "---------------------------------- first allocation start" << std::endl;
+	benchmark_first_allocation();
+	std::cout << "---------------------------------- first allocation end" << std::endl;
+
+	std::cout << "---------------------------------- vector start" << std::endl;
+	test_vector();
+	test_contiguous_reuse();
+	std::cout << "---------------------------------- vector end" << std::endl;
+
+	std::cout << "---------------------------------- bulk start" << std::endl;
+	benchmark_bulk();
+	std::cout << "---------------------------------- bulk end" << std::endl;
+
+	std::cout << "---------------------------------- general manager trace replay start" << std::endl;
+	benchmark_general_manager();
+	std::cout << "---------------------------------- general manager trace replay end" << std::endl;
+
+	std::cout << "---------------------------------- thread-safe pools start" << std::endl;
+	test_thread_cache_churn();
+	benchmark_thread_safe_pools();
+	std::cout << "---------------------------------- thread-safe pools end" << std::endl;
+
 	std::cout << "---------------------------------- unique_ptr start" << std::endl;
 	test_unique_ptr();
 	std::cout << "---------------------------------- unique_ptr end" << std::endl;
@@ -0,0 +1,179 @@
+#include <iostream>
+#include <vector>
+#include <string>
+
+#include <cstdint>
+#include <cassert>
+
+#include <my-lib/slot-pool.h>
+
+// counts the live objects, to check that the pool calls the destructors
+struct Counted {
+	static inline int32_t n_alive = 0;
+
+	std::string name;
+
+	Counted (const std::string& name_)
+		: name(name_)
+	{
+		n_alive++;
+	}
+
+	~Counted ()
+	{
+		n_alive--;
+	}
+};
+
+using Pool = Mylib::SlotPool<Counted>;
+using Handle = Pool::Handle;
+using SmallPool = Mylib::SlotPool<int32_t, uint32_t, 20, 4>;
+
+void test_handles ()
+{
+	Pool pool;
+
+	std::cout << "sizeof handle is " << sizeof(Handle) << std::endl;
+
+	Handle null;
+	assert(null.is_null());
+	assert(!pool.is_valid(null));
+	assert(pool.get(null) == nullptr);
+
+	Handle john = pool.create("John");
+	Handle mary = pool.create("Mary");
+
+	std::cout << "john index " << john.get_index() << " generation " << john.get_generation() << std::endl;
+	std::cout << "mary index " << mary.get_index() << " generation " << mary.get_generation() << std::endl;
+
+	assert(!john.is_null());
+	assert(pool.is_valid(john) && pool.is_valid(mary));
+	assert(pool[john].name == "John" && pool.get(mary)->name == "Mary");
+	assert(pool.get_size() == 2 && Counted::n_alive == 2);
+	assert(pool.get_handle(pool.get(mary)) == mary);
+
+	pool.destroy(john);
+
+	assert(!pool.is_valid(john));
+	assert(pool.get(john) == nullptr);
+	assert(pool.get_size() == 1 && Counted::n_alive == 1);
+
+	// the slot of john is reused, but the old handle stays invalid
+	Handle paul = pool.create("Paul");
+
+	std::cout << "paul index " << paul.get_index() << " generation " << paul.get_generation() << std::endl;
+
+	assert(paul.get_index() == john.get_index());
+	assert(paul != john);
+	assert(!pool.is_valid(john));
+	assert(pool[paul].name == "Paul");
+
+	try {
+		pool.destroy(john);
+		assert(0);
+	}
+	catch (const Mylib::Exception& e) {
+		std::cout << "\tdestroying a stale handle throws" << std::endl;
+	}
+
+	pool.clear();
+
+	assert(pool.get_size() == 0 && Counted::n_alive == 0);
+	assert(!pool.is_valid(mary) && !pool.is_valid(paul));
+}
+
+void test_iteration ()
+{
+	SmallPool pool;
+	std::vector<SmallPool::Handle> handles;
+
+	std::cout << "sizeof small handle is " << sizeof(SmallPool::Handle) << std::endl;
+
+	for (int32_t i = 0; i < 10; i++)
+		handles.push_back(pool.create(i));
+
+	std::cout << "capacity " << pool.get_capacity() << " for " << pool.get_size() << " objects" << std::endl;
+	assert(pool.get_capacity() == 12);
+
+	// destroy the odd ones
+	for (int32_t i = 1; i < 10; i += 2)
+		pool.destroy(handles[i]);
+
+	int32_t sum = 0;
+	uint32_t n = 0;
+
+	for (int32_t value : pool) {
+		assert((value % 2) == 0);
+		sum += value;
+		n++;
+	}
+
+	std::cout << "iterated over " << n << " objects, sum " << sum << std::endl;
+	assert(n == 5 && sum == 20);
+
+	for (auto it = pool.begin(); it != pool.end(); ++it)
+		assert(pool.get(it.get_handle()) == &(*it));
+
+	// destroy inside for_each
+	pool.for_each([&pool] (const SmallPool::Handle handle, int32_t& value) {
+		if (value >= 6)
+			pool.destroy(handle);
+	});
+
+	assert(pool.get_size() == 3);
+
+	// the freed slots are reused before the pool grows
+	for (int32_t i = 0; i < 7; i++)
+		pool.create(100 + i);
+
+	assert(pool.get_size() == 10);
+	assert(pool.get_capacity() == 12);
+
+	for (uint32_t i = 0; i < handles.size(); i++) {
+		if (i == 0 || i == 2 || i == 4)
+			assert(pool.is_valid(handles[i]));
+		else
+			assert(!pool.is_valid(handles[i]));
+	}
+
+	const SmallPool& const_pool = pool;
+	n = 0;
+
+	for (const int32_t& value : const_pool) {
+		(void)value;
+		n++;
+	}
+
+	assert(n == 10);
+}
+
+void test_churn ()
+{
+	SmallPool pool;
+	const SmallPool::Handle first = pool.create(0);
+
+	pool.destroy(first);
+
+	// a single slot reused many times never validates the first handle again
+	// (until the 12 bits of generation wrap around)
+	for (int32_t i = 0; i < 1000; i++) {
+		SmallPool::Handle h = pool.create(i);
+		assert(h.get_index() == first.get_index());
+		assert(!pool.is_valid(first));
+		pool.destroy(h);
+	}
+
+	assert(pool.get_capacity() == 4);
+	std::cout << "churn ok" << std::endl;
+}
+
+int main ()
+{
+	test_handles();
+	test_iteration();
+	test_churn();
+
+	std::cout << "all tests passed" << std::endl;
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #include <vector>
 #include <coroutine>
 #include <list>
+#include <chrono>
 
 #include <cstdint>
 #include <cassert>
@@ -107,6 +108,49 @@ public:
 
 test_t test;
 
+// ---------------------------------------------------
+
+uint32_t bench_time = 0;
+
+uint32_t get_bench_time ()
+{
+	return bench_time;
+}
+
+void benchmark_schedule_unschedule ()
+{
+	constexpr uint32_t n_events = 1000;
+	constexpr uint32_t n_rounds = 2000;
+
+	auto bench_timer = Mylib::Event::make_timer<Coroutine>(get_bench_time);
+	using BenchTimer = decltype(bench_timer);
+
+	std::vector<BenchTimer::Descriptor> descriptors(n_events);
+	uint64_t sum = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (uint32_t round = 0; round < n_rounds; round++) {
+		for (auto& d : descriptors)
+			d = bench_timer.schedule_event(bench_time + 1, [&sum] (BenchTimer::Event& event) { sum += event.time; });
+
+		for (auto& d : descriptors)
+			bench_timer.unschedule_event(d);
+
+		// the unscheduled events are released when their time comes
+		bench_time++;
+		bench_timer.trigger_events();
+	}
+
+	auto end = std::chrono::steady_clock::now();
+
+	const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+
+	std::cout << "schedule_event + unschedule_event: " << (ns / static_cast<double>(n_rounds * n_events)) << " ns (sizeof descriptor " << sizeof(BenchTimer::Descriptor) << ", sum " << sum << ")" << std::endl;
+}
+
+// ---------------------------------------------------
+
 int main ()
 {
 	std::cout << "scheduling object function without params" << std::endl;
@@ -121,11 +165,16 @@ int main ()
 	timer.schedule_event(3, Mylib::Event::make_callback_object< Timer::Event >(test, &test_t::callback));
 
 	auto d = timer.schedule_event(55, Mylib::Event::make_callback_object< Timer::Event >(test, &test_t::callback));
+	auto d2 = timer.schedule_event(60, Mylib::Event::make_callback_object< Timer::Event >(test, &test_t::callback));
 
 	std::cout << "created " << timer.get_n_scheduled_events() << " events" << std::endl;
 
+	assert(timer.is_valid(d) && timer.is_valid(d2));
+
 	timer.unschedule_event(d);
 
+	assert(!timer.is_valid(d) && timer.is_valid(d2));
+
 	std::cout << "created " << timer.get_n_scheduled_events() << " events" << std::endl;
 
 	// ensure that test object was not copy/moved
@@ -136,7 +185,12 @@ int main ()
 
 	timer.trigger_events();
 
+	// triggered events release their descriptors
+	assert(!timer.is_valid(d2));
+
 	test_coroutine();
 
+	benchmark_schedule_unschedule();
+
 	return 0;
 }
\ No newline at end of file